@@ -0,0 +1,91 @@
+#ifndef FLOAT_MATH_H
+#define FLOAT_MATH_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace fparse {
+	// 浮点模式的标量函数: 多项式近似，不调用 libm
+	// 函数体只含算术、比较与选择 (没有依赖数据的分支)，逐元素套用的循环可被编译器向量化
+	// 常数化简与运行时求值使用同一份实现
+	namespace fastmath {
+		constexpr float pi = 3.14159265f;
+
+		inline float fromBits(uint32_t bits) { float value; std::memcpy(&value, &bits, sizeof(value)); return value; }
+		inline uint32_t toBits(float value) { uint32_t bits; std::memcpy(&bits, &value, sizeof(bits)); return bits; }
+
+		// 转换为 int32 (向零取整): NaN 为 0，超出 int32 的值截断到边界
+		inline int32_t toInt(float x) {
+			x = x == x ? x : 0.f;
+			x = x < -2147483648.f ? -2147483648.f : x;
+			x = x > 2147483520.f ? 2147483520.f : x;					// 小于 2^31 的最大 float
+			return static_cast<int32_t>(x);
+		}
+
+		// 以周期为单位的相位，归约到 [-0.25, 0.25] (sin 的单调区间); |turns| >= 2^23 时 float 已没有小数部分，相位为 0
+		inline float foldedPhase(float turns) {
+			turns = (turns < 8388608.f && turns > -8388608.f) ? turns : 0.f;
+			float r = turns - static_cast<float>(static_cast<int32_t>(turns + (turns >= 0.f ? 0.5f : -0.5f)));	// [-0.5, 0.5]
+			r = r > 0.25f ? 0.5f - r : r;
+			return r < -0.25f ? -0.5f - r : r;
+		}
+
+		// sin(x)，x 为弧度; [-pi/2, pi/2] 上的 9 次奇多项式，误差约 4e-6
+		inline float sin(float x) {
+			float z = foldedPhase(x * (0.5f / pi)) * (2.f * pi);
+			float z2 = z * z;
+			return z * (1.f + z2 * (-0.16666667f + z2 * (0.0083333333f + z2 * (-1.9841270e-4f + z2 * 2.7557319e-6f))));
+		}
+
+		inline float cos(float x) {
+			return sin(x + 0.5f * pi);
+		}
+
+		// 与 sin 同相位、同周期的三角波 (-1..1)
+		inline float tri(float x) {
+			return 4.f * foldedPhase(x * (0.5f / pi));
+		}
+
+		// 2^x: 整数部分写入指数位，小数部分 ([-0.5, 0.5]) 用 5 次多项式，相对误差约 3e-6; x 截断到 [-126, 127]
+		inline float exp2(float x) {
+			x = x == x ? x : 0.f;
+			x = x < -126.f ? -126.f : x;
+			x = x > 127.f ? 127.f : x;
+			int32_t n = static_cast<int32_t>(x + (x >= 0.f ? 0.5f : -0.5f));
+			float f = x - static_cast<float>(n);
+			float p = 1.f + f * (0.69314718f + f * (0.24022651f + f * (0.05550411f + f * (0.00961813f + f * 0.00133336f))));
+			return p * fromBits(static_cast<uint32_t>(n + 127) << 23);
+		}
+
+		// log2(x)，x 为正的规格化数: 指数位加上尾数 ([sqrt(2)/2, sqrt(2)]) 的 atanh 级数，误差约 5e-8
+		inline float log2(float x) {
+			uint32_t bits = toBits(x);
+			int32_t exponent = static_cast<int32_t>((bits >> 23) & 255) - 127;
+			float m = fromBits((bits & 0x007FFFFFu) | 0x3F800000u);		// [1, 2)
+			bool high = m > 1.41421356f;
+			m = high ? 0.5f * m : m;
+			exponent += high ? 1 : 0;
+			float s = (m - 1.f) / (m + 1.f);
+			float s2 = s * s;
+			float ln = 2.f * s * (1.f + s2 * (0.33333333f + s2 * (0.2f + s2 * 0.14285714f)));
+			return static_cast<float>(exponent) + ln * 1.44269504f;
+		}
+
+		inline float exp(float x) {
+			return exp2(x * 1.44269504f);
+		}
+
+		// pow(x, y): x < 0 时只对整数 y 有定义 (符号由 y 的奇偶决定)，否则为 0
+		// pow(0, y) 为 0 (y == 0 时为 1)，负指数也取 0 而不是无穷大，与除以 0 的约定一致
+		inline float pow(float x, float y) {
+			float ax = x < 0.f ? -x : x;
+			bool zero = !(ax > 1.0e-30f);
+			float r = exp2(y * log2(zero ? 1.f : ax));
+			r = zero ? (y == 0.f ? 1.f : 0.f) : r;
+			int32_t integer = toInt(y);
+			bool is_integer = static_cast<float>(integer) == y;
+			return x < 0.f ? (is_integer ? ((integer & 1) != 0 ? -r : r) : 0.f) : r;
+		}
+	};
+};
+#endif
@@ -0,0 +1,162 @@
+#include <cctype>
+#include <string>
+
+#include "FormulaCache.h"
+#include "FormulaCost.h"
+
+using namespace fparse;
+using namespace std;
+
+static bool isWordChar(char c) {
+	return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// 两个字符之间原本有空白时，删去空白是否会改变分词
+static bool needsSeparator(char a, char b) {
+	if (isWordChar(a) && isWordChar(b)) return true;						// 名字、关键字、数字
+	if (a == '-' && isdigit(static_cast<unsigned char>(b))) return true;	// "- 1" 不是负数字面量
+	if ((isdigit(static_cast<unsigned char>(a)) && b == '.') || (a == '.' && isdigit(static_cast<unsigned char>(b)))) return true;	// "1 .5" 与 "1. 5" 不是小数字面量
+	if ((a == '<' && b == '<') || (a == '>' && b == '>')) return true;		// 移位运算符
+	if (a == '/' && (b == '/' || b == '*')) return true;					// 注释起始
+	if (a == '*' && b == '/') return true;									// 注释结束
+	return false;
+}
+
+string fparse::normalizeFormula(const string& source) {
+	string result;
+	result.reserve(source.size());
+
+	bool pending_space = false;
+	bool leading_comment = false;		// 开头的注释: 其后的 #float 不是指令
+	size_t i = 0;
+
+	while (i < source.size()) {
+		char c = source[i];
+
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			pending_space = true;
+			i++;
+			continue;
+		}
+
+		if (c == '/' && i + 1 < source.size() && source[i + 1] == '/') {		// 行注释
+			while (i < source.size() && source[i] != '\n' && source[i] != '\r')
+				i++;
+			pending_space = true;
+			leading_comment = leading_comment || result.empty();
+			continue;
+		}
+
+		if (c == '/' && i + 1 < source.size() && source[i + 1] == '*') {		// 块注释
+			size_t end = source.find("*/", i + 2);
+			if (end == string::npos) {
+				// 未闭合的注释是语法错误，保留原文使其不会命中任何合法公式
+				result += source.substr(i);
+				break;
+			}
+			i = end + 2;
+			pending_space = true;
+			leading_comment = leading_comment || result.empty();
+			continue;
+		}
+
+		if (pending_space && !result.empty() && needsSeparator(result.back(), c))
+			result += ' ';
+		if (result.empty() && leading_comment && c == '#')					// 保留一个空注释，使其仍不被识别为指令
+			result += "/**/";
+		pending_space = false;
+
+		result += c;
+		i++;
+	}
+
+	return result;
+}
+
+
+// 缓存类
+FormulaCache& FormulaCache::getInstance() {
+	static FormulaCache instance;
+	return instance;
+}
+
+// 缓存中的 cost 可能在校准之前估计，取出时按当前的开销表重新计算
+static ParseResult withCurrentCost(ParseResult result) {
+	if (result.program != nullptr)
+		result.cost = estimateCost(*result.program, *OperatorCosts::getCurrent());
+	return result;
+}
+
+FormulaCache::FormulaCache(size_t max_entries) : capacity(max_entries) {}
+
+ParseResult FormulaCache::parse(const FormulaParser& parser, const string& source) {
+	string key = normalizeFormula(source);
+
+	{
+		lock_guard<std::mutex> lock(mutex);
+		auto it = index.find(key);
+		if (it != index.end()) {
+			entries.splice(entries.begin(), entries, it->second);		// 移到最前
+			return withCurrentCost(it->second->second);
+		}
+	}
+
+	// 解析不持有锁，其他实例可以同时查询
+	ParseResult result = parser.parse(source);
+	if (result.success) {
+		lock_guard<std::mutex> lock(mutex);
+		insertNormalized(key, result);
+	}
+	return result;
+}
+
+bool FormulaCache::lookup(const string& source, ParseResult& result) {
+	string key = normalizeFormula(source);
+
+	lock_guard<std::mutex> lock(mutex);
+	auto it = index.find(key);
+	if (it == index.end())
+		return false;
+
+	entries.splice(entries.begin(), entries, it->second);
+	result = withCurrentCost(it->second->second);
+	return true;
+}
+
+void FormulaCache::insert(const string& source, const ParseResult& result) {
+	if (!result.success)
+		return;
+
+	string key = normalizeFormula(source);
+
+	lock_guard<std::mutex> lock(mutex);
+	insertNormalized(key, result);
+}
+
+void FormulaCache::insertNormalized(const string& key, const ParseResult& result) {
+	auto it = index.find(key);
+	if (it != index.end()) {
+		it->second->second = result;
+		entries.splice(entries.begin(), entries, it->second);
+		return;
+	}
+
+	entries.emplace_front(key, result);
+	index[key] = entries.begin();
+
+	while (entries.size() > capacity) {			// 淘汰最久未使用的公式
+		index.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+
+void FormulaCache::clear() {
+	lock_guard<std::mutex> lock(mutex);
+	entries.clear();
+	index.clear();
+}
+
+size_t FormulaCache::size() {
+	lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
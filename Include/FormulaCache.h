@@ -0,0 +1,47 @@
+#ifndef FORMULA_CACHE_H
+#define FORMULA_CACHE_H
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 去掉注释与不影响分词的空白，得到公式的规范文本
+	// 只在两侧字符拼接后会改变分词结果的位置 (如 "a b"、"- 1"、"1 .5"、"< <") 保留一个空格，保证规范文本相同的公式解析结果相同
+	std::string normalizeFormula(const std::string& source);
+
+	// 以规范文本为键的解析结果缓存 (LRU)，同一进程内的所有插件实例共享
+	// 只缓存解析成功的结果: Program 在解析后不再被修改，可以被多个实例同时使用；
+	// 失败的结果每次重新解析，以得到与原始文本对应的行列号
+	// 开销估计不取缓存的值: 命中时按 OperatorCosts::getCurrent() 重新计算，校准之后不会沿用旧的估计
+	class FormulaCache {
+	public:
+		static constexpr size_t default_capacity = 256;
+
+		static FormulaCache& getInstance();												// 进程内共享的缓存
+
+		explicit FormulaCache(size_t max_entries = default_capacity);
+
+		ParseResult parse(const FormulaParser& parser, const std::string& source);		// 命中则直接返回，否则解析并缓存
+		bool lookup(const std::string& source, ParseResult& result);						// 只查询，不解析
+		void insert(const std::string& source, const ParseResult& result);
+
+		void clear();
+		size_t size();
+
+	private:
+		using Entry = std::pair<std::string, ParseResult>;
+
+		size_t capacity;
+		std::list<Entry> entries;															// 按最近使用排序，最近的在前
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+		std::mutex mutex;
+
+		void insertNormalized(const std::string& key, const ParseResult& result);
+	};
+};
+#endif
@@ -0,0 +1,179 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <xtensor/xarray.hpp>
+#include <xtensor/xbuilder.hpp>
+
+#include "FormulaCost.h"
+
+using namespace fparse;
+using namespace std;
+
+const OperatorCosts& OperatorCosts::defaults() {
+	static const OperatorCosts costs = {
+		{
+			0.0,	// NONE
+			0.3,	// ADD
+			0.3,	// SUBTRACT
+			0.4,	// MULTIPLY
+			2.5,	// DIVIDE (含除数为 0 的检查)
+			2.7,	// MOD
+			0.3,	// AND
+			0.3,	// OR
+			0.3,	// XOR
+			1.0,	// SHIFT_LEFT (含移位量取模)
+			1.0,	// SHIFT_RIGHT
+		},
+		{ { "sin", 3.0 }, { "cos", 3.2 }, { "tri", 3.0 }, { "rand", 6.0 }, { "abs", 0.5 }, { "srand", 2.5 }, { "pow", 8.0 }, { "exp", 4.0 } },
+		0.2,
+		150.0,
+		0.5,
+		0.75,
+		1.5,
+	};
+	return costs;
+}
+
+static shared_ptr<const OperatorCosts>& currentCosts() {
+	static shared_ptr<const OperatorCosts> costs = make_shared<const OperatorCosts>(OperatorCosts::defaults());
+	return costs;
+}
+
+shared_ptr<const OperatorCosts> OperatorCosts::getCurrent() {
+	return atomic_load(&currentCosts());
+}
+
+void OperatorCosts::setCurrent(shared_ptr<const OperatorCosts> costs) {
+	atomic_store(&currentCosts(), costs);
+}
+
+
+// 单个表达式每次求值的平均耗时 (ns)
+static double measure(const Expression& expr, const unordered_map<string, EvaluationResult>& vars, size_t block_size, int iterations) {
+	expr.evaluate(vars, block_size);		// 预热
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		expr.evaluate(vars, block_size);
+	return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+}
+
+OperatorCosts fparse::calibrateOperatorCosts(size_t block_size, int iterations) {
+	OperatorCosts costs = OperatorCosts::defaults();
+
+	unordered_map<string, EvaluationResult> vars, single;
+	vars["t"] = xt::arange<int32_t>(1, static_cast<int32_t>(block_size) + 1);
+	vars["x"] = xt::arange<int32_t>(1, static_cast<int32_t>(block_size) + 1) % 200 + 1;	// 非 0，避免除法走特殊路径
+	single["t"] = EvaluationResult({ 1 });
+	single["x"] = EvaluationResult({ 3 });
+
+	auto t = make_shared<Variable>("t");
+	auto x = make_shared<Variable>("x");
+
+	// 叶节点与固定开销: 大 block 给出每个 sample 的开销，单个 sample 的求值近似为固定开销
+	double leaf_total = measure(*t, vars, block_size, iterations);
+	costs.leaf_ns = leaf_total / block_size;
+
+	CompoundExpression reference(Operation::ADD, t, x);
+	double reference_single = measure(reference, single, 1, iterations * 20);
+	costs.call_ns = reference_single;
+
+	// 逐 sample 求值: 同一表达式 (三个节点) 经 evaluateScalar 求值
+	{
+		auto scalar_t = make_shared<Variable>("t");
+		auto scalar_x = make_shared<Variable>("x");
+		scalar_t->slot = 0;
+		scalar_x->slot = 1;
+		CompoundExpression scalar(Operation::ADD, scalar_t, scalar_x);
+		vector<int32_t> slots = { 1, 3 };
+		volatile int32_t sink = 0;												// 防止循环被优化掉
+		auto start = chrono::steady_clock::now();
+		for (size_t i = 0; i < block_size * iterations; i++) {
+			slots[0] = static_cast<int32_t>(i);
+			sink = sink ^ scalar.evaluateScalar(slots.data());
+		}
+		double total = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+		costs.scalar_ns = total / static_cast<double>(block_size * iterations) / 3.;
+	}
+
+	// 运算符: 去掉两个叶节点的开销
+	for (int op = static_cast<int>(Operation::ADD); op <= static_cast<int>(Operation::SHIFT_RIGHT); op++) {
+		CompoundExpression expr(static_cast<Operation>(op), t, x);
+		double total = measure(expr, vars, block_size, iterations);
+		costs.operation_ns[op] = max(0., (total - 2 * leaf_total) / block_size);
+	}
+
+	// 函数: 参数统一为 t
+	for (const auto& [name, function] : FormulaParser::function_dictionary) {
+		if (function.function == nullptr)		// 只能在浮点模式中使用 (pow exp)，保留默认值
+			continue;
+		vector<shared_ptr<Expression>> args(function.lower_bound, t);
+		FunctionExpression expr(name, args);
+		double total = measure(expr, vars, block_size, iterations);
+		costs.function_ns[name] = max(0., (total - args.size() * leaf_total) / block_size);
+	}
+
+	// 窄 lane: 同一运算在 uint8 / uint16 中的开销之比
+	// 只有叶节点需要从 int32 截断，窄 lane 内部的节点直接使用子节点的窄结果: 以 (t + x) + x 与 t + x 之差
+	// 计时多出的一个节点，两种路径都扣除同样的叶节点与截断开销
+	CompoundExpression inner(Operation::ADD, t, x);
+	CompoundExpression outer(Operation::ADD, make_shared<CompoundExpression>(Operation::ADD, t, x), x);
+	auto timeEvaluation = [&](auto evaluate) {
+		evaluate();
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			evaluate();
+		return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+		};
+	double wide = measure(outer, vars, block_size, iterations) - measure(inner, vars, block_size, iterations);
+	if (wide > 0.) {
+		double narrow8 = timeEvaluation([&]() { outer.evaluate8(vars, block_size); }) - timeEvaluation([&]() { inner.evaluate8(vars, block_size); });
+		double narrow16 = timeEvaluation([&]() { outer.evaluate16(vars, block_size); }) - timeEvaluation([&]() { inner.evaluate16(vars, block_size); });
+		costs.lane8_factor = max(0., narrow8) / wide;
+		costs.lane16_factor = max(0., narrow16) / wide;
+	}
+
+	return costs;
+}
+
+
+// 递归累加: per_sample 为每个 sample 的开销，calls 为节点数 (每个节点一次固定开销)
+static void accumulate(const Expression& expr, const OperatorCosts& costs, double& per_sample, size_t& calls) {
+	calls++;
+
+	if (auto compound = dynamic_cast<const CompoundExpression*>(&expr)) {
+		double factor = compound->lane_bits == 8 ? costs.lane8_factor : compound->lane_bits == 16 ? costs.lane16_factor : 1.;
+		per_sample += costs.operation_ns[static_cast<int>(compound->operation)] * factor;
+		accumulate(*compound->l, costs, per_sample, calls);
+		accumulate(*compound->r, costs, per_sample, calls);
+		return;
+	}
+
+	if (auto function = dynamic_cast<const FunctionExpression*>(&expr)) {
+		auto it = costs.function_ns.find(function->name);
+		per_sample += it != costs.function_ns.end() ? it->second : costs.call_ns / 64.;
+		for (const auto& arg : function->args)
+			accumulate(*arg, costs, per_sample, calls);
+		return;
+	}
+
+	per_sample += costs.leaf_ns;
+}
+
+double fparse::estimateCost(const Program& program, const OperatorCosts& costs, size_t block_size) {
+	double per_sample = 0.;
+	size_t calls = 0;
+
+	for (const Statement& statement : program.statements)
+		if (statement.kind != StatementKind::STATE)		// 状态变量的初始值不被求值
+			accumulate(*statement.expr, costs, per_sample, calls);
+	for (const shared_ptr<Expression>& output : program.outputs)
+		accumulate(*output, costs, per_sample, calls);
+
+	if (program.sequential)
+		return per_sample + calls * costs.scalar_ns;
+	return per_sample + calls * costs.call_ns / static_cast<double>(block_size);
+}
@@ -0,0 +1,34 @@
+#ifndef FORMULA_COST_H
+#define FORMULA_COST_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 各类节点的求值开销 (ns)
+	struct OperatorCosts {
+		double operation_ns[11];												// 每个 sample，以 Operation 为下标
+		std::unordered_map<std::string, double> function_ns;					// 每个 sample，以函数名为键
+		double leaf_ns;															// 变量 / 常数，每个 sample
+		double call_ns;															// 每次节点求值与 block 大小无关的固定开销
+		double lane8_factor;													// 在 uint8 / uint16 lane 中求值时相对 int32 的开销
+		double lane16_factor;
+		double scalar_ns;														// 含状态变量的公式逐 sample 求值 (evaluateScalar) 时每个节点的开销
+
+		static const OperatorCosts& defaults();								// 未校准时使用的内置值
+		static std::shared_ptr<const OperatorCosts> getCurrent();				// 进程内当前使用的表 (校准后被替换)
+		static void setCurrent(std::shared_ptr<const OperatorCosts> costs);
+	};
+
+	// 校准: 在当前机器上对每种运算符 / 函数分别计时 (约几十毫秒)
+	OperatorCosts calibrateOperatorCosts(size_t block_size = 2048, int iterations = 50);
+
+	// 静态开销估计: 每个 voice 每个 sample 的 ns 数
+	// 按节点类型加权求和，节点的固定开销按 block_size 摊分; 含状态变量的公式逐 sample 求值，以 scalar_ns 代替固定开销
+	double estimateCost(const Program& program, const OperatorCosts& costs, size_t block_size = 512);
+};
+#endif
@@ -1,17 +1,34 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <assert.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <locale>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <type_traits>
 
 #include <peglib.h>
 #include <xtensor/xarray.hpp>
+#include <xtensor/xbuilder.hpp>
 #include <xtensor/xio.hpp>
 #include <xtensor/xindex_view.hpp>
 #include <xtensor/xrandom.hpp>
 
 #include "FormulaParser.h"
+#include "FloatMath.h"
+#include "FormulaCost.h"
+#include "PrattParser.h"
 
 using namespace fparse;
 using namespace peg;
@@ -19,7 +36,12 @@ using namespace std;
 
 // 语法
 const char* FormulaParser::grammar = R"(
-		INPUT       <- EXPRESSION {no_ast_opt}
+		INPUT       <- STATEMENT* OUTPUT {no_ast_opt}
+		STATEMENT   <- ( STATEDECL / LETBINDING / ASSIGNMENT ) ';'
+		STATEDECL   <- 'state' NAME '=' EXPRESSION
+		LETBINDING  <- 'let' NAME '=' EXPRESSION
+		ASSIGNMENT  <- NAME '=' EXPRESSION
+		OUTPUT      <- '[' EXPRESSION ( ',' EXPRESSION )* ']' / EXPRESSION
 		EXPRESSION  <- ATOM (OPERATOR ATOM)* {
 				 precedence
 				   L ^
@@ -31,9 +53,11 @@ const char* FormulaParser::grammar = R"(
 		ATOM        <- NUMBER / FUNCCALL / VAR / '(' EXPRESSION ')'
 		FUNCCALL	<- FUNCNAME '(' ( EXPRESSION ( ',' EXPRESSION )* )? ')'	{ no_ast_opt }
 		OPERATOR    <- < '+' | '-' | '*' | '/' | '%' | '^' | '&' | '|' | '>>' | '<<' >
-		NUMBER      <- < '-'? [0-9]+ >
+		NUMBER      <- < '-'? [0-9]+ ('.' [0-9]+)? >
 		FUNCNAME    <- < [a-zA-Z_] [0-9a-zA-Z_]* > & '('
 		VAR			<- < [a-zA-Z_] [0-9a-zA-Z_]* > ! '('
+		NAME		<- < [a-zA-Z_] [0-9a-zA-Z_]* >
+		%word		<- [a-zA-Z_] [0-9a-zA-Z_]*
 		%whitespace <- [ \t\n\r]* ( ( ('//' [^\n\r]* [\n\r]*) / ('/*' (!'*/' .)* '*/') ) [ \t\n\r]* )*
     )";
 
@@ -82,63 +106,267 @@ const EvaluationResult FormulaParser::triangle_table({
 	   109, 111, 113, 115, 117, 119, 121, 123, 125 });
 
 // 合法变量名及常数化简求值用的暂时变量值
-unordered_map<string, EvaluationResult> FormulaParser::temp_vars = {
-	{"T", EvaluationResult(0)},
-	{"t", EvaluationResult(0)},
-	{"w", EvaluationResult(0)},
-	{"x", EvaluationResult(0)},
-	{"y", EvaluationResult(0)},
-	{"z", EvaluationResult(0)},
-	//{"env1", EvaluationResult(0)},
-	//{"env2", EvaluationResult(0)},
-	//{"env3", EvaluationResult(0)},
-	//{"env4", EvaluationResult(0)}
-};
+// 调制源: env vel bend (每个 voice)，lfo1 lfo2 与 cc0 ... cc127 (所有 voice 共享)
+const unordered_map<string, EvaluationResult> FormulaParser::temp_vars = [] {
+	unordered_map<string, EvaluationResult> vars = {
+		{"T", EvaluationResult(0)},
+		{"t", EvaluationResult(0)},
+		{"w", EvaluationResult(0)},
+		{"x", EvaluationResult(0)},
+		{"y", EvaluationResult(0)},
+		{"z", EvaluationResult(0)},
+		{"in", EvaluationResult(0)},
+		{"inL", EvaluationResult(0)},
+		{"inR", EvaluationResult(0)},
+		{"env", EvaluationResult(0)},
+		{"vel", EvaluationResult(0)},
+		{"bend", EvaluationResult(0)},
+		{"lfo1", EvaluationResult(0)},
+		{"lfo2", EvaluationResult(0)},
+	};
+	for (int cc = 0; cc < 128; cc++)
+		vars["cc" + to_string(cc)] = EvaluationResult(0);
+	return vars;
+}();
+
+// 内置变量的值域 (t 与 T 由 double 转换而来，很长时间后可能溢出，不作假设)
+const RangeMap FormulaParser::variable_ranges = [] {
+	RangeMap ranges = {
+		{"T", ValueRange::full()},
+		{"t", ValueRange::full()},
+		{"w", {0, 255}},
+		{"x", {0, 255}},
+		{"y", {0, 255}},
+		{"z", {0, 255}},
+		{"in", {0, 65535}},				// 输入音频按 output_bits 量化为无符号整数 (最多 16 位)
+		{"inL", {0, 65535}},
+		{"inR", {0, 65535}},
+		{"env", {0, 255}},				// 增益包络 (按住为 255，release 时衰减)
+		{"vel", {0, 127}},
+		{"bend", {0, 255}},				// 弯音轮的高 8 位，中点为 128
+		{"lfo1", {0, 255}},
+		{"lfo2", {0, 255}},
+	};
+	for (int cc = 0; cc < 128; cc++)
+		ranges["cc" + to_string(cc)] = { 0, 127 };
+	return ranges;
+}();
+
+// 逐元素套用 fastmath 中的标量函数; 循环体没有分支，可被编译器向量化
+template <typename Function>
+static FloatResult mapFloat(const FloatResult& x, Function function) {
+	FloatResult result = FloatResult::from_shape(x.shape());
+	const float* in = x.data();
+	float* out = result.data();
+	for (size_t i = 0; i < x.size(); i++)
+		out[i] = function(in[i]);
+	return result;
+}
+
+// 两个参数的版本: 单元素的参数 (宏、常数) 广播到另一参数的长度
+template <typename Function>
+static FloatResult mapFloat(const FloatResult& x, const FloatResult& y, Function function) {
+	size_t size = max(x.size(), y.size());
+	FloatResult result = FloatResult::from_shape({ size });
+	const float* in_x = x.data();
+	const float* in_y = y.data();
+	float* out = result.data();
+	if (x.size() == y.size())
+		for (size_t i = 0; i < size; i++)
+			out[i] = function(in_x[i], in_y[i]);
+	else if (x.size() == 1)
+		for (size_t i = 0; i < size; i++)
+			out[i] = function(in_x[0], in_y[i]);
+	else
+		for (size_t i = 0; i < size; i++)
+			out[i] = function(in_x[i], in_y[0]);
+	return result;
+}
+
+// float 转换为 int32 (fastmath::toInt)，浮点模式中的位运算与 srand 使用
+static EvaluationResult toIntegers(const FloatResult& x) {
+	EvaluationResult result = EvaluationResult::from_shape(x.shape());
+	const float* in = x.data();
+	int32_t* out = result.data();
+	for (size_t i = 0; i < x.size(); i++)
+		out[i] = fastmath::toInt(in[i]);
+	return result;
+}
+
+// srand 的整数哈希，两种模式共用
+static xt::xarray<uint32_t> srandHash(const EvaluationResult& x) {
+	xt::xarray<uint32_t> r = (xt::cast<uint32_t>(x) + 3463u) * 2971u;
+	r = r ^ (r << 13);
+	r = r ^ xt::cast<uint32_t>(xt::cast<int32_t>(r) >> 17);		// 算术右移
+	return r ^ (r << 5);
+}
+
+static uint32_t srandHash(int32_t x) {
+	uint32_t r = (static_cast<uint32_t>(x) + 3463u) * 2971u;
+	r = r ^ (r << 13);
+	r = r ^ static_cast<uint32_t>(static_cast<int32_t>(r) >> 17);
+	return r ^ (r << 5);
+}
 
 // 合法的函数名及实现
-unordered_map<string, FunctionWithBound> FormulaParser::function_dictionary = {
+// 整数模式的实现为空的函数 (pow exp) 只能在浮点模式中使用; 浮点模式中 sin cos tri 以弧度为参数，rand srand 的结果为 [0, 1)
+const unordered_map<string, FunctionWithBound> FormulaParser::function_dictionary = {
 	{
 		"sin",
 		{ [](const vector<shared_ptr<Expression>>& args, const unordered_map<string, EvaluationResult>& vars, size_t block_size) -> EvaluationResult {
-			return xt::index_view(FormulaParser::sine_table, (args[0]->evaluate(vars, block_size) % 256 + 256) % 256);
-		}, 1 , 1}
+			return xt::index_view(FormulaParser::sine_table, args[0]->evaluate(vars, block_size) & 255);
+		}, 1 , 1,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return mapFloat(args[0]->evaluateFloat(vars, block_size), fastmath::sin);
+		},
+		[](const int32_t* args) -> int32_t {
+			return FormulaParser::sine_table[args[0] & 255];
+		}}
 	},
 	{
 		"cos",
 		{ [](const vector<shared_ptr<Expression>>& args, const unordered_map<string, EvaluationResult>& vars, size_t block_size) -> EvaluationResult {
-			return xt::index_view(FormulaParser::sine_table, ((args[0]->evaluate(vars, block_size) + 64) % 256 + 256) % 256);
-		}, 1 , 1}
+			return xt::index_view(FormulaParser::sine_table, (xt::cast<uint32_t>(args[0]->evaluate(vars, block_size)) + 64u) & 255u);
+		}, 1 , 1,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return mapFloat(args[0]->evaluateFloat(vars, block_size), fastmath::cos);
+		},
+		[](const int32_t* args) -> int32_t {
+			return FormulaParser::sine_table[(static_cast<uint32_t>(args[0]) + 64u) & 255u];
+		}}
 	},
 	{
 		"tri",
 		{ [](const vector<shared_ptr<Expression>>& args, const unordered_map<string, EvaluationResult>& vars, size_t block_size) -> EvaluationResult {
-			return xt::index_view(FormulaParser::triangle_table, (args[0]->evaluate(vars, block_size) % 256 + 256) % 256);
-		}, 1 , 1}
+			return xt::index_view(FormulaParser::triangle_table, args[0]->evaluate(vars, block_size) & 255);
+		}, 1 , 1,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return mapFloat(args[0]->evaluateFloat(vars, block_size), fastmath::tri);
+		},
+		[](const int32_t* args) -> int32_t {
+			return FormulaParser::triangle_table[args[0] & 255];
+		}}
 	},
 	{
 		"rand",
 		{ [](const vector<shared_ptr<Expression>>& args, const unordered_map<string, EvaluationResult>& vars, size_t block_size) -> EvaluationResult {
 			return xt::random::randint({block_size}, 0, 255);
-		}, 0 , 0}
+		}, 0 , 0,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return xt::random::rand<float>({ block_size });
+		},
+		[](const int32_t*) -> int32_t {
+			return uniform_int_distribution<int32_t>(0, 254)(xt::random::get_default_random_engine());	// 与 randint 相同，上界不含
+		}}
 	},
 	{
 		"abs",
 		{ [](const vector<shared_ptr<Expression>>& args, const unordered_map<string, EvaluationResult>& vars, size_t block_size) -> EvaluationResult {
-			return xt::abs(args[0]->evaluate(vars, block_size));
-		}, 1 , 1}
+			EvaluationResult value = args[0]->evaluate(vars, block_size);
+			return xt::cast<int32_t>(xt::where(value < 0, 0u - xt::cast<uint32_t>(value), xt::cast<uint32_t>(value)));	// abs(INT32_MIN) 为 INT32_MIN
+		}, 1 , 1,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return xt::abs(args[0]->evaluateFloat(vars, block_size));
+		},
+		[](const int32_t* args) -> int32_t {
+			uint32_t value = static_cast<uint32_t>(args[0]);
+			return static_cast<int32_t>(args[0] < 0 ? 0u - value : value);
+		}}
 	},
 	{
 		"srand",
 		{ [](const vector<shared_ptr<Expression>>& args, const unordered_map<string, EvaluationResult>& vars, size_t block_size) -> EvaluationResult {
-			EvaluationResult r = args[0]->evaluate(vars, block_size);
-			r = ((r + 3463) * 2971);
-			r = r ^ (r << 13);
-			r = r ^ (r >> 17);
-			return r ^ (r << 5);
-		}, 1 , 1}
+			return xt::cast<int32_t>(srandHash(args[0]->evaluate(vars, block_size)));
+		}, 1 , 1,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return xt::cast<float>(srandHash(toIntegers(args[0]->evaluateFloat(vars, block_size))) & 0xFFFFFFu) * (1.f / 16777216.f);	// 高位不能精确转换为 float，取低 24 位
+		},
+		[](const int32_t* args) -> int32_t {
+			return static_cast<int32_t>(srandHash(args[0]));
+		}}
+	},
+	{
+		"pow",
+		{ nullptr, 2 , 2,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return mapFloat(args[0]->evaluateFloat(vars, block_size), args[1]->evaluateFloat(vars, block_size), fastmath::pow);
+		}}
+	},
+	{
+		"exp",
+		{ nullptr, 1 , 1,
+		[](const vector<shared_ptr<Expression>>& args, const unordered_map<string, FloatResult>& vars, size_t block_size) -> FloatResult {
+			return mapFloat(args[0]->evaluateFloat(vars, block_size), fastmath::exp);
+		}}
 	}
 };
 
+// profile
+static thread_local EvaluationProfile* active_profile = nullptr;
+
+ScopedProfiling::ScopedProfiling(EvaluationProfile& profile) : previous(active_profile) {
+	active_profile = &profile;
+}
+
+ScopedProfiling::~ScopedProfiling() {
+	active_profile = previous;
+}
+
+namespace {
+	// 统计一次节点求值的耗时; 子节点的耗时从父节点的 self 中扣除
+	class NodeTimer {
+	public:
+		NodeTimer(const Expression* expression, size_t block_size) : node(expression), samples(block_size) {
+			if (active_profile == nullptr)
+				return;
+			profile = active_profile;
+			parent = current;
+			current = this;
+			start = chrono::steady_clock::now();
+		}
+
+		~NodeTimer() {
+			if (profile == nullptr)
+				return;
+			double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+			NodeProfile& node_profile = profile->nodes[node];
+			node_profile.calls++;
+			node_profile.samples += samples;
+			node_profile.inclusive_ns += elapsed;
+			node_profile.self_ns += elapsed - children_ns;
+			profile->total_ns += elapsed - children_ns;
+
+			if (parent != nullptr)
+				parent->children_ns += elapsed;
+			current = parent;
+		}
+
+	private:
+		static thread_local NodeTimer* current;
+
+		const Expression* node;
+		size_t samples;
+		EvaluationProfile* profile = nullptr;
+		NodeTimer* parent = nullptr;
+		double children_ns = 0.;
+		chrono::steady_clock::time_point start;
+	};
+
+	thread_local NodeTimer* NodeTimer::current = nullptr;
+}
+
+
+// 表达式基类: 默认在 int32 中求值后截断
+NarrowResult8 Expression::evaluate8(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	return xt::cast<uint8_t>(evaluate(vars, block_size));
+}
+
+NarrowResult16 Expression::evaluate16(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	return xt::cast<uint16_t>(evaluate(vars, block_size));
+}
+
+
 // 变量类
 Variable::Variable(const string& name) : name(name) {};
 
@@ -149,16 +377,54 @@ EvaluationResult Variable::evaluate(const unordered_map<string, EvaluationResult
 	return vars.at(name);
 }
 
+ValueRange Variable::range(const RangeMap& ranges) const {
+	auto it = ranges.find(name);
+	return it != ranges.end() ? it->second : ValueRange::full();
+}
+
+NarrowResult8 Variable::evaluate8(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	return xt::cast<uint8_t>(vars.at(name));
+}
+
+NarrowResult16 Variable::evaluate16(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	return xt::cast<uint16_t>(vars.at(name));
+}
+
+FloatResult Variable::evaluateFloat(const unordered_map<string, FloatResult>& vars, size_t block_size) const {
+	return vars.at(name);
+}
+
 
 // 常量类
-Constant::Constant(int32_t value) : value(value) {};
+Constant::Constant(int32_t value) : value(value), float_value(static_cast<float>(value)) {};
 
-string Constant::toString() const { return to_string(value); }
+Constant::Constant(int32_t value, float float_value) : value(value), float_value(float_value) {};
+
+string Constant::toString() const {
+	if (float_value == static_cast<float>(value))
+		return to_string(value);
+	ostringstream stream;				// 浮点模式中带小数部分的常数
+	stream.imbue(locale::classic());
+	stream << setprecision(9) << float_value;
+	return stream.str();
+}
 
 EvaluationResult Constant::evaluate(const unordered_map<string, EvaluationResult>&, size_t block_size) const {			// evaluation
 	return xt::broadcast(value, { block_size });
 }
 
+NarrowResult8 Constant::evaluate8(const unordered_map<string, EvaluationResult>&, size_t block_size) const {
+	return xt::broadcast(static_cast<uint8_t>(value), { block_size });
+}
+
+NarrowResult16 Constant::evaluate16(const unordered_map<string, EvaluationResult>&, size_t block_size) const {
+	return xt::broadcast(static_cast<uint16_t>(value), { block_size });
+}
+
+FloatResult Constant::evaluateFloat(const unordered_map<string, FloatResult>&, size_t block_size) const {
+	return xt::broadcast(float_value, { block_size });
+}
+
 
 // 二元表达式类
 CompoundExpression::CompoundExpression(Operation op, shared_ptr<Expression> lhs, shared_ptr<Expression> rhs)
@@ -183,26 +449,257 @@ string CompoundExpression::toString() const {
 }
 
 EvaluationResult CompoundExpression::evaluate(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	// 值域可证明足够小的节点在窄 lane 中求值，再扩展回 int32
+	if (lane_bits == 8)
+		return lane_signed ? EvaluationResult(xt::cast<int32_t>(xt::cast<int8_t>(evaluate8(vars, block_size)))) : EvaluationResult(xt::cast<int32_t>(evaluate8(vars, block_size)));
+	if (lane_bits == 16)
+		return lane_signed ? EvaluationResult(xt::cast<int32_t>(xt::cast<int16_t>(evaluate16(vars, block_size)))) : EvaluationResult(xt::cast<int32_t>(evaluate16(vars, block_size)));
+	return evaluateWide(vars, block_size);
+}
+
+// int32 中的二元运算，也用于浮点模式中的位运算
+static EvaluationResult wideOperation(Operation operation, const EvaluationResult& leftValue, const EvaluationResult& rightValue) {
+	switch (operation) {
+	// 语义与 applyOperation 相同: 回绕运算在 uint32 中进行，不发生有符号溢出
+	case Operation::ADD: return xt::cast<int32_t>(xt::cast<uint32_t>(leftValue) + xt::cast<uint32_t>(rightValue));
+	case Operation::SUBTRACT: return xt::cast<int32_t>(xt::cast<uint32_t>(leftValue) - xt::cast<uint32_t>(rightValue));
+	case Operation::MULTIPLY: return xt::cast<int32_t>(xt::cast<uint32_t>(leftValue) * xt::cast<uint32_t>(rightValue));
+	case Operation::DIVIDE: {		// xt::where 两侧都会求值: 除数 0 与 -1 先换成 1，避免除零与 INT32_MIN / -1 的硬件异常
+		auto zero = xt::equal(rightValue, 0);
+		auto minus_one = xt::equal(rightValue, -1);
+		EvaluationResult quotient = leftValue / xt::where(zero || minus_one, 1, rightValue);
+		return xt::where(zero, 0, xt::where(minus_one, xt::cast<int32_t>(0u - xt::cast<uint32_t>(leftValue)), quotient));
+	}
+	case Operation::MOD:			// x % 1 == 0，恰好是除数为 0 与 -1 时的结果
+		return leftValue % xt::where(xt::equal(rightValue, 0) || xt::equal(rightValue, -1), 1, rightValue);
+	case Operation::AND: return leftValue & rightValue;
+	case Operation::OR: return leftValue | rightValue;
+	case Operation::XOR: return leftValue ^ rightValue;
+	case Operation::SHIFT_LEFT: return xt::cast<int32_t>(xt::cast<uint32_t>(leftValue) << xt::cast<uint32_t>(rightValue & 15));
+	case Operation::SHIFT_RIGHT: return leftValue >> (rightValue & 15);
+	default: throw invalid_argument("Invalid operation"); // invalid operation
+	}
+}
+
+EvaluationResult CompoundExpression::evaluateWide(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	NodeTimer timer(this, block_size);
+
 	EvaluationResult leftValue = l->evaluate(vars, block_size);		// l operand
 	EvaluationResult rightValue = r->evaluate(vars, block_size);	// r operand
+	return wideOperation(operation, leftValue, rightValue);
+}
+
+FloatResult CompoundExpression::evaluateFloat(const unordered_map<string, FloatResult>& vars, size_t block_size) const {
+	NodeTimer timer(this, block_size);
+
+	FloatResult leftValue = l->evaluateFloat(vars, block_size);
+	FloatResult rightValue = r->evaluateFloat(vars, block_size);
 
 	switch (operation) {
+	// 语义与 applyFloatOperation 相同
 	case Operation::ADD: return leftValue + rightValue;
 	case Operation::SUBTRACT: return leftValue - rightValue;
 	case Operation::MULTIPLY: return leftValue * rightValue;
-	case Operation::DIVIDE:
-		return xt::where(xt::equal(rightValue, 0), 0, leftValue / rightValue);
-	case Operation::MOD:
-		return xt::where(xt::equal(rightValue, 0), 0, leftValue % rightValue);
-	case Operation::AND: return leftValue & rightValue;
-	case Operation::OR: return leftValue | rightValue;
-	case Operation::XOR: return leftValue ^ rightValue;
-	case Operation::SHIFT_LEFT: return leftValue << (rightValue % 16);
-	case Operation::SHIFT_RIGHT: return leftValue >> (rightValue % 16);
+	case Operation::DIVIDE: {
+		auto zero = xt::equal(rightValue, 0.f);
+		return xt::where(zero, 0.f, leftValue / xt::where(zero, 1.f, rightValue));
+	}
+	case Operation::MOD: {			// 余数的符号与被除数相同 (fmod)
+		auto zero = xt::equal(rightValue, 0.f);
+		FloatResult divisor = xt::where(zero, 1.f, rightValue);
+		return xt::where(zero, 0.f, leftValue - divisor * xt::trunc(leftValue / divisor));
+	}
+	default:
+		return xt::cast<float>(wideOperation(operation, toIntegers(leftValue), toIntegers(rightValue)));
+	}
+}
+
+int32_t CompoundExpression::evaluateScalar(const int32_t* slots) const {
+	NodeTimer timer(this, 1);
+	int32_t leftValue = l->evaluateScalar(slots);
+	return applyOperation(operation, leftValue, r->evaluateScalar(slots));
+}
+
+
+// 按 lane 类型分派到 evaluate8 / evaluate16
+template <typename Lane>
+static xt::xarray<Lane> evaluateAs(const Expression& expr, const unordered_map<string, EvaluationResult>& vars, size_t block_size) {
+	if constexpr (is_same_v<Lane, uint8_t>)
+		return expr.evaluate8(vars, block_size);
+	else
+		return expr.evaluate16(vars, block_size);
+}
+
+// 逐元素在 Lane 中计算: 循环体的结果立即截断回 Lane，编译器可以直接使用 8 / 16 位的向量指令
+// 单元素的操作数 (宏、let 绑定的常数) 广播到另一操作数的长度
+template <typename Lane, typename Function>
+static xt::xarray<Lane> mapLanes(const xt::xarray<Lane>& x, const xt::xarray<Lane>& y, Function function) {
+	size_t size = max(x.size(), y.size());
+	xt::xarray<Lane> result = xt::xarray<Lane>::from_shape({ size });
+	const Lane* in_x = x.data();
+	const Lane* in_y = y.data();
+	Lane* out = result.data();
+	if (x.size() == y.size())
+		for (size_t i = 0; i < size; i++)
+			out[i] = function(in_x[i], in_y[i]);
+	else if (x.size() == 1)
+		for (size_t i = 0; i < size; i++)
+			out[i] = function(in_x[0], in_y[i]);
+	else
+		for (size_t i = 0; i < size; i++)
+			out[i] = function(in_x[i], in_y[0]);
+	return result;
+}
+
+// 回绕运算的结果的低位只取决于操作数的低位，可以整体在窄 lane 中计算
+// 乘法与移位先提升为 uint32_t (uint16 * uint16 提升为 int 时可能溢出)，其余运算提升为 int 后不会溢出
+template <typename Lane>
+xt::xarray<Lane> CompoundExpression::evaluateNarrow(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	if (!isModular())
+		return xt::cast<Lane>(evaluateWide(vars, block_size));
+
+	NodeTimer timer(this, block_size);
+
+	xt::xarray<Lane> leftValue = evaluateAs<Lane>(*l, vars, block_size);		// l operand
+
+	if (operation == Operation::SHIFT_LEFT) {									// 移位量为常数
+		uint32_t shift = static_cast<uint32_t>(dynamic_pointer_cast<Constant>(r)->value & 15);
+		xt::xarray<Lane> result = xt::xarray<Lane>::from_shape(leftValue.shape());
+		const Lane* in = leftValue.data();
+		Lane* out = result.data();
+		for (size_t i = 0; i < leftValue.size(); i++)
+			out[i] = static_cast<Lane>(static_cast<uint32_t>(in[i]) << shift);
+		return result;
+	}
+
+	xt::xarray<Lane> rightValue = evaluateAs<Lane>(*r, vars, block_size);		// r operand
+
+	switch (operation) {
+	case Operation::ADD: return mapLanes(leftValue, rightValue, [](Lane a, Lane b) { return static_cast<Lane>(a + b); });
+	case Operation::SUBTRACT: return mapLanes(leftValue, rightValue, [](Lane a, Lane b) { return static_cast<Lane>(a - b); });
+	case Operation::MULTIPLY: return mapLanes(leftValue, rightValue, [](Lane a, Lane b) { return static_cast<Lane>(static_cast<uint32_t>(a) * b); });
+	case Operation::AND: return mapLanes(leftValue, rightValue, [](Lane a, Lane b) { return static_cast<Lane>(a & b); });
+	case Operation::OR: return mapLanes(leftValue, rightValue, [](Lane a, Lane b) { return static_cast<Lane>(a | b); });
+	case Operation::XOR: return mapLanes(leftValue, rightValue, [](Lane a, Lane b) { return static_cast<Lane>(a ^ b); });
 	default: throw invalid_argument("Invalid operation"); // invalid operation
 	}
 }
 
+NarrowResult8 CompoundExpression::evaluate8(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	return evaluateNarrow<uint8_t>(vars, block_size);
+}
+
+NarrowResult16 CompoundExpression::evaluate16(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	return evaluateNarrow<uint16_t>(vars, block_size);
+}
+
+bool CompoundExpression::isModular() const {
+	switch (operation) {
+	case Operation::ADD:
+	case Operation::SUBTRACT:
+	case Operation::MULTIPLY:
+	case Operation::AND:
+	case Operation::OR:
+	case Operation::XOR:
+		return true;
+	case Operation::SHIFT_LEFT:
+		return dynamic_pointer_cast<Constant>(r) != nullptr;
+	default:
+		return false;
+	}
+}
+
+void CompoundExpression::annotateLanes(const RangeMap& ranges, bool enabled) {
+	l->annotateLanes(ranges, enabled);
+	r->annotateLanes(ranges, enabled);
+
+	lane_bits = 32;
+	lane_signed = false;
+
+	// 只有窄 lane 区域至少包含两个运算时，节省的运算才能抵消转换的开销
+	auto isModularOperation = [](const shared_ptr<Expression>& expr) {
+		return dynamic_pointer_cast<CompoundExpression>(expr) != nullptr && expr->isModular();
+		};
+	if (!enabled || !isModular() || !(isModularOperation(l) || isModularOperation(r)))
+		return;
+
+	ValueRange value_range = range(ranges);
+	if (value_range.fitsUnsigned(8) || value_range.fitsSigned(8)) {
+		lane_bits = 8;
+		lane_signed = !value_range.fitsUnsigned(8);
+	}
+	else if (value_range.fitsUnsigned(16) || value_range.fitsSigned(16)) {
+		lane_bits = 16;
+		lane_signed = !value_range.fitsUnsigned(16);
+	}
+}
+
+// 能容纳 range 的最小 k，使 range 落在 [-2^k, 2^k - 1] 内 (按位运算的结果也在其中)
+static int envelopeBits(const ValueRange& range) {
+	int k = 0;
+	while (k < 32 && !(range.lo >= -(int64_t(1) << k) && range.hi < (int64_t(1) << k)))
+		k++;
+	return k;
+}
+
+// rhs & 15 的取值范围
+static void shiftCountRange(const ValueRange& range, int64_t& count_min, int64_t& count_max) {
+	bool exact = range.lo >= 0 && range.hi < 16;
+	count_min = exact ? range.lo : 0;
+	count_max = exact ? range.hi : 15;
+}
+
+ValueRange CompoundExpression::range(const RangeMap& ranges) const {
+	ValueRange a = l->range(ranges);
+	ValueRange b = r->range(ranges);
+
+	switch (operation) {
+	case Operation::ADD: return ValueRange::of(a.lo + b.lo, a.hi + b.hi);
+	case Operation::SUBTRACT: return ValueRange::of(a.lo - b.hi, a.hi - b.lo);
+	case Operation::MULTIPLY: {
+		int64_t products[] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+		return ValueRange::of(*min_element(begin(products), end(products)), *max_element(begin(products), end(products)));
+	}
+	case Operation::DIVIDE: {		// |l / r| <= |l|，除数为 0 时结果为 0 (INT32_MIN / -1 回绕为 INT32_MIN，此时 m 超出 int32，退化为 full)
+		if (a.lo >= 0 && b.lo >= 0)
+			return { 0, a.hi };
+		int64_t m = max(-a.lo, a.hi);
+		return ValueRange::of(min<int64_t>(-m, 0), max<int64_t>(m, 0));
+	}
+	case Operation::MOD: {			// 结果的符号与 l 相同，|l % r| < |r|
+		int64_t m = max(-a.lo, a.hi);
+		int64_t divisor = max(-b.lo, b.hi);
+		int64_t bound = max<int64_t>(min(m, divisor - 1), 0);
+		if (a.lo >= 0) return { 0, bound };
+		if (a.hi <= 0) return { -bound, 0 };
+		return { -bound, bound };
+	}
+	case Operation::AND:
+		if (a.lo >= 0 && b.lo >= 0) return { 0, min(a.hi, b.hi) };
+		if (a.lo >= 0) return { 0, a.hi };
+		if (b.lo >= 0) return { 0, b.hi };
+		[[fallthrough]];
+	case Operation::OR:
+	case Operation::XOR: {
+		int k = max(envelopeBits(a), envelopeBits(b));
+		if (k >= 32) return ValueRange::full();
+		if (a.lo >= 0 && b.lo >= 0) return { 0, (int64_t(1) << k) - 1 };
+		return { -(int64_t(1) << k), (int64_t(1) << k) - 1 };
+	}
+	case Operation::SHIFT_LEFT: {
+		int64_t count_min, count_max;
+		shiftCountRange(b, count_min, count_max);
+		int64_t scale_min = int64_t(1) << count_min, scale_max = int64_t(1) << count_max;
+		return ValueRange::of(min(a.lo * scale_min, a.lo * scale_max), max(a.hi * scale_min, a.hi * scale_max));
+	}
+	case Operation::SHIFT_RIGHT: {
+		int64_t count_min, count_max;
+		shiftCountRange(b, count_min, count_max);
+		return { min(a.lo >> count_min, a.lo >> count_max), max(a.hi >> count_min, a.hi >> count_max) };
+	}
+	default: return ValueRange::full();
+	}
+}
 
 // 函数表达式类
 FunctionExpression::FunctionExpression(string function_name, vector<shared_ptr<Expression>> function_args)
@@ -217,9 +714,289 @@ string FunctionExpression::toString() const {
 }
 
 EvaluationResult FunctionExpression::evaluate(const unordered_map<string, EvaluationResult>& vars, size_t block_size) const {
+	NodeTimer timer(this, block_size);
 	return function.function(args, vars, block_size);
 }
 
+FloatResult FunctionExpression::evaluateFloat(const unordered_map<string, FloatResult>& vars, size_t block_size) const {
+	NodeTimer timer(this, block_size);
+	return function.float_function(args, vars, block_size);
+}
+
+int32_t FunctionExpression::evaluateScalar(const int32_t* slots) const {
+	NodeTimer timer(this, 1);
+	int32_t values[2] = { 0, 0 };				// 函数最多有两个参数
+	for (size_t i = 0; i < args.size(); i++)
+		values[i] = args[i]->evaluateScalar(slots);
+	return function.scalar_function(values);
+}
+
+ValueRange FunctionExpression::range(const RangeMap& ranges) const {
+	if (name == "sin" || name == "cos" || name == "tri" || name == "rand")	// 查表 / 随机数
+		return { 0, 255 };
+	if (name == "abs") {
+		ValueRange a = args[0]->range(ranges);
+		if (a.lo >= 0) return a;
+		return ValueRange::of(0, max(-a.lo, a.hi));			// abs(INT32_MIN) 回绕为负数，此时退化为 full
+	}
+	return ValueRange::full();
+}
+
+void FunctionExpression::annotateLanes(const RangeMap& ranges, bool enabled) {
+	for (const shared_ptr<Expression>& arg : args)
+		arg->annotateLanes(ranges, enabled);
+}
+
+
+// 收集表达式中用到的内置变量 (不含 let 绑定与状态变量)
+static void collectVariables(const Expression& expr, unordered_set<string>& names) {
+	if (auto variable = dynamic_cast<const Variable*>(&expr)) {
+		if (FormulaParser::temp_vars.count(variable->name) != 0)
+			names.insert(variable->name);
+	}
+	else if (auto compound = dynamic_cast<const CompoundExpression*>(&expr)) {
+		collectVariables(*compound->l, names);
+		collectVariables(*compound->r, names);
+	}
+	else if (auto function = dynamic_cast<const FunctionExpression*>(&expr)) {
+		for (const shared_ptr<Expression>& arg : function->args)
+			collectVariables(*arg, names);
+	}
+}
+
+// 为表达式中的变量分配槽位: 同名变量共用一个槽位
+static void bindVariableSlots(Expression& expr, unordered_map<string, int>& indices, vector<string>& names) {
+	if (auto variable = dynamic_cast<Variable*>(&expr)) {
+		auto [it, inserted] = indices.try_emplace(variable->name, static_cast<int>(names.size()));
+		if (inserted)
+			names.push_back(variable->name);
+		variable->slot = it->second;
+	}
+	else if (auto compound = dynamic_cast<CompoundExpression*>(&expr)) {
+		bindVariableSlots(*compound->l, indices, names);
+		bindVariableSlots(*compound->r, indices, names);
+	}
+	else if (auto function = dynamic_cast<FunctionExpression*>(&expr)) {
+		for (const shared_ptr<Expression>& arg : function->args)
+			bindVariableSlots(*arg, indices, names);
+	}
+}
+
+// 多语句公式类
+Program::Program(vector<Statement> program_statements, shared_ptr<Expression> output_expr, bool float_program)
+	: Program(program_statements, vector<shared_ptr<Expression>>{ output_expr }, float_program) {}
+
+Program::Program(vector<Statement> program_statements, vector<shared_ptr<Expression>> output_exprs, bool float_program)
+	: statements(program_statements), outputs(output_exprs), expr(output_exprs.at(0)), float_mode(float_program) {
+	for (const Statement& statement : statements)
+		if (statement.kind == StatementKind::STATE)
+			sequential = true;
+
+	// 值域: 状态变量在运行中任意变化，let 绑定按源码顺序由其表达式推得
+	ranges = FormulaParser::variable_ranges;
+	for (const Statement& statement : statements)
+		if (statement.kind == StatementKind::STATE)
+			ranges[statement.name] = ValueRange::full();
+	for (const Statement& statement : statements)
+		if (statement.kind == StatementKind::LET)
+			ranges[statement.name] = statement.expr->range(ranges);
+
+	for (const Statement& statement : statements)
+		collectVariables(*statement.expr, variables);
+	for (const shared_ptr<Expression>& output : outputs)
+		collectVariables(*output, variables);
+
+	setLanesEnabled(true);
+	if (sequential)
+		bindSlots();
+}
+
+void Program::bindSlots() {
+	unordered_map<string, int> indices;
+	slot_names.clear();
+	statement_slots.clear();
+	for (const Statement& statement : statements) {
+		auto [it, inserted] = indices.try_emplace(statement.name, static_cast<int>(slot_names.size()));
+		if (inserted)
+			slot_names.push_back(statement.name);
+		statement_slots.push_back(it->second);
+	}
+	for (const Statement& statement : statements)
+		bindVariableSlots(*statement.expr, indices, slot_names);
+	for (const shared_ptr<Expression>& output : outputs)
+		bindVariableSlots(*output, indices, slot_names);
+}
+
+void Program::setLanesEnabled(bool enabled) {
+	lanes_enabled = enabled;
+	for (const Statement& statement : statements)
+		statement.expr->annotateLanes(ranges, enabled);
+	for (const shared_ptr<Expression>& output : outputs)
+		output->annotateLanes(ranges, enabled);
+}
+
+string Program::toString() const {
+	string result_str;
+	for (const Statement& statement : statements) {
+		switch (statement.kind) {
+		case StatementKind::LET: result_str += "let "; break;
+		case StatementKind::STATE: result_str += "state "; break;
+		default: break;
+		}
+		result_str += statement.name + " = " + statement.expr->toString() + "; ";
+	}
+	if (outputs.size() == 1)
+		return result_str + expr->toString();
+
+	result_str += "[";
+	for (size_t i = 0; i < outputs.size(); i++)
+		result_str += (i > 0 ? ", " : "") + outputs[i]->toString();
+	return result_str + "]";
+}
+
+void Program::resetState(unordered_map<string, EvaluationResult>& vars) const {
+	initState(vars, true);
+}
+
+void Program::initState(unordered_map<string, EvaluationResult>& vars, bool reset) const {
+	for (const Statement& statement : statements) {
+		if (statement.kind != StatementKind::STATE)
+			continue;
+		// 公式在 note 播放过程中被替换时，新的状态变量在第一次求值时才被创建
+		if (reset || vars.count(statement.name) == 0)
+			vars[statement.name] = EvaluationResult({ dynamic_pointer_cast<Constant>(statement.expr)->value });
+	}
+}
+
+void Program::evaluateOutputs(unordered_map<string, EvaluationResult>& vars, size_t block_size, vector<EvaluationResult>& results, int output_bits) const {
+	results.resize(outputs.size());
+
+	if (float_mode) {
+		// -1..1 对应 0..256 (与插件中两种模式的电平一致)，截断到 0..255; NaN 为 128
+		unordered_map<string, FloatResult> float_vars;
+		vector<FloatResult> float_results;
+		evaluateFloatOutputs(vars, float_vars, block_size, float_results);
+		for (size_t i = 0; i < outputs.size(); i++)
+			results[i] = toIntegers(FloatResult(xt::clip(xt::where(xt::isnan(float_results[i]), 0.f, float_results[i]) * 128.f + 128.f, 0.f, 255.f)));
+		return;
+	}
+
+	if (sequential) {
+		evaluateSequential(vars, block_size, results);
+		return;
+	}
+
+	// 每个绑定整体求值一次，写入同名槽位 (形状不变时不会重新分配内存)
+	for (const Statement& statement : statements)
+		vars[statement.name] = statement.expr->evaluate(vars, block_size);
+
+	for (size_t i = 0; i < outputs.size(); i++) {
+		const Expression& output = *outputs[i];
+		// 只需要低位时，顶层的回绕运算不必关心值域，直接在窄 lane 中求值
+		if (lanes_enabled && output.isModular() && output_bits <= 8)
+			results[i] = xt::cast<int32_t>(output.evaluate8(vars, block_size));
+		else if (lanes_enabled && output.isModular() && output_bits <= 16)
+			results[i] = xt::cast<int32_t>(output.evaluate16(vars, block_size));
+		else
+			results[i] = output.evaluate(vars, block_size);
+	}
+}
+
+EvaluationResult Program::evaluate(unordered_map<string, EvaluationResult>& vars, size_t block_size, int output_bits) const {
+	vector<EvaluationResult> results;
+	evaluateOutputs(vars, block_size, results, output_bits);
+	return std::move(results[0]);
+}
+
+void Program::evaluateSequential(unordered_map<string, EvaluationResult>& vars, size_t block_size, vector<EvaluationResult>& results) const {
+	initState(vars, false);
+
+	// 单个 sample 的变量值存放在 int32 槽位中 (下标见 bindSlots)，节点经 evaluateScalar 求值，循环中不分配内存
+	// 向量变量 (t, T, ...) 每个 sample 取出对应元素，其余 (宏、状态变量) 在 block 开始时写入一次
+	vector<int32_t> slots(slot_names.size(), 0);
+	vector<pair<int32_t*, const int32_t*>> vector_slots;						// (槽位, 整个 block 的值)
+	for (size_t k = 0; k < slot_names.size(); k++) {
+		auto it = vars.find(slot_names[k]);
+		if (it == vars.end())
+			continue;															// let 绑定在第一次赋值之前不会被读取
+		if (it->second.size() > 1)
+			vector_slots.emplace_back(&slots[k], it->second.data());
+		else
+			slots[k] = it->second[0];
+	}
+
+	for (EvaluationResult& result : results)
+		result = xt::zeros<int32_t>({ block_size });
+
+	for (size_t i = 0; i < block_size; i++) {
+		for (auto& [slot, value] : vector_slots)
+			*slot = value[i];
+
+		// 按源码顺序执行，后面的语句看到的是本 sample 中前面语句的结果
+		for (size_t s = 0; s < statements.size(); s++)
+			if (statements[s].kind != StatementKind::STATE)
+				slots[statement_slots[s]] = statements[s].expr->evaluateScalar(slots.data());
+
+		for (size_t k = 0; k < outputs.size(); k++)
+			results[k][i] = outputs[k]->evaluateScalar(slots.data());
+	}
+
+	// 将状态变量写回，供下一个 block 使用 (initState 保证其为单个元素)
+	for (size_t s = 0; s < statements.size(); s++)
+		if (statements[s].kind == StatementKind::STATE)
+			vars[statements[s].name][0] = slots[statement_slots[s]];
+}
+
+void Program::evaluateFloatOutputs(const unordered_map<string, EvaluationResult>& inputs, unordered_map<string, FloatResult>& vars, size_t block_size, vector<FloatResult>& results) const {
+	for (const string& name : variables) {
+		auto input = inputs.find(name);
+		if (input != inputs.end())
+			vars[name] = xt::cast<float>(input->second);
+	}
+
+	for (const Statement& statement : statements)
+		vars[statement.name] = statement.expr->evaluateFloat(vars, block_size);
+
+	results.resize(outputs.size());
+	for (size_t i = 0; i < outputs.size(); i++)
+		results[i] = outputs[i]->evaluateFloat(vars, block_size);
+}
+
+// 单个值上的运算: 常数化简使用，与 CompoundExpression 的求值结果逐位一致
+int32_t fparse::applyOperation(Operation operation, int32_t lhs, int32_t rhs) {
+	uint32_t a = static_cast<uint32_t>(lhs);
+	uint32_t b = static_cast<uint32_t>(rhs);
+
+	switch (operation) {
+	case Operation::ADD: return static_cast<int32_t>(a + b);
+	case Operation::SUBTRACT: return static_cast<int32_t>(a - b);
+	case Operation::MULTIPLY: return static_cast<int32_t>(a * b);
+	case Operation::DIVIDE:
+		if (rhs == 0) return 0;
+		if (rhs == -1) return static_cast<int32_t>(0u - a);
+		return lhs / rhs;
+	case Operation::MOD:
+		if (rhs == 0 || rhs == -1) return 0;
+		return lhs % rhs;
+	case Operation::AND: return lhs & rhs;
+	case Operation::OR: return lhs | rhs;
+	case Operation::XOR: return lhs ^ rhs;
+	case Operation::SHIFT_LEFT: return static_cast<int32_t>(a << (rhs & 15));
+	case Operation::SHIFT_RIGHT: return lhs >> (rhs & 15);
+	default: throw invalid_argument("Invalid operation"); // invalid operation
+	}
+}
+
+float fparse::applyFloatOperation(Operation operation, float lhs, float rhs) {
+	switch (operation) {
+	case Operation::ADD: return lhs + rhs;
+	case Operation::SUBTRACT: return lhs - rhs;
+	case Operation::MULTIPLY: return lhs * rhs;
+	case Operation::DIVIDE: return rhs == 0.f ? 0.f : lhs / rhs;
+	case Operation::MOD: return rhs == 0.f ? 0.f : lhs - rhs * trunc(lhs / rhs);
+	default: return static_cast<float>(applyOperation(operation, fastmath::toInt(lhs), fastmath::toInt(rhs)));
+	}
+}
 
 // +
 shared_ptr<Expression> operator+(shared_ptr<Expression> lhs, shared_ptr<Expression> rhs) {
@@ -227,7 +1004,7 @@ shared_ptr<Expression> operator+(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value + r->value);
+		return make_shared<Constant>(applyOperation(Operation::ADD, l->value, r->value));
 	} // preprocess 0
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return rhs;
@@ -241,7 +1018,7 @@ shared_ptr<Expression> operator-(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value - r->value);
+		return make_shared<Constant>(applyOperation(Operation::SUBTRACT, l->value, r->value));
 	}
 	else if (rhs->isConstant() && dynamic_pointer_cast<Constant>(rhs)->value == 0)
 		return lhs;
@@ -253,7 +1030,7 @@ shared_ptr<Expression> operator*(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value * r->value);
+		return make_shared<Constant>(applyOperation(Operation::MULTIPLY, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return make_shared<Constant>(0);
@@ -267,9 +1044,7 @@ shared_ptr<Expression> operator/(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		if (r->value == 0)
-			return make_shared<Constant>(0);
-		return make_shared<Constant>(l->value / r->value);
+		return make_shared<Constant>(applyOperation(Operation::DIVIDE, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return make_shared<Constant>(0);
@@ -283,9 +1058,7 @@ shared_ptr<Expression> operator%(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		if (r->value == 0)
-			return make_shared<Constant>(0);
-		return make_shared<Constant>(l->value % r->value);
+		return make_shared<Constant>(applyOperation(Operation::MOD, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return make_shared<Constant>(0);
@@ -299,7 +1072,7 @@ shared_ptr<Expression> operator&(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value & r->value);
+		return make_shared<Constant>(applyOperation(Operation::AND, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return make_shared<Constant>(0);
@@ -313,7 +1086,7 @@ shared_ptr<Expression> operator|(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value | r->value);
+		return make_shared<Constant>(applyOperation(Operation::OR, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return rhs;
@@ -327,7 +1100,7 @@ shared_ptr<Expression> operator^(shared_ptr<Expression> lhs, shared_ptr<Expressi
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value ^ r->value);
+		return make_shared<Constant>(applyOperation(Operation::XOR, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return rhs;
@@ -341,11 +1114,11 @@ shared_ptr<Expression> operator<<(shared_ptr<Expression> lhs, shared_ptr<Express
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value << (r->value % 16));
+		return make_shared<Constant>(applyOperation(Operation::SHIFT_LEFT, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return make_shared<Constant>(0);
-	else if (rhs->isConstant() && dynamic_pointer_cast<Constant>(rhs)->value % 16 == 0)
+	else if (rhs->isConstant() && (dynamic_pointer_cast<Constant>(rhs)->value & 15) == 0)
 		return lhs;
 
 	return make_shared<CompoundExpression>(Operation::SHIFT_LEFT, lhs, rhs);
@@ -355,16 +1128,23 @@ shared_ptr<Expression> operator>>(shared_ptr<Expression> lhs, shared_ptr<Express
 	if (lhs->isConstant() && rhs->isConstant()) {
 		auto l = dynamic_pointer_cast<Constant>(lhs);
 		auto r = dynamic_pointer_cast<Constant>(rhs);
-		return make_shared<Constant>(l->value >> (r->value % 16));
+		return make_shared<Constant>(applyOperation(Operation::SHIFT_RIGHT, l->value, r->value));
 	}
 	else if (lhs->isConstant() && dynamic_pointer_cast<Constant>(lhs)->value == 0)
 		return make_shared<Constant>(0);
-	else if (rhs->isConstant() && dynamic_pointer_cast<Constant>(rhs)->value % 16 == 0)
+	else if (rhs->isConstant() && (dynamic_pointer_cast<Constant>(rhs)->value & 15) == 0)
 		return lhs;
 
 	return make_shared<CompoundExpression>(Operation::SHIFT_RIGHT, lhs, rhs);
 }
 
+// OPERATOR token 的值: 运算符的首字符及其位置
+struct OperatorToken {
+	char symbol;
+	size_t line;
+	size_t col;
+};
+
 shared_ptr<Expression> castToExpression(const any& value) {
 	if (value.type() == typeid(shared_ptr<Constant>))
 		return any_cast<shared_ptr<Constant>>(value);
@@ -386,98 +1166,402 @@ shared_ptr<Expression> castToExpression(const any& value) {
 }
 
 
+// 检查 let / state 声明的名字是否可用
+static bool checkDeclarable(const ParseContext& context, const string& name, string& msg) {
+	// t T w x y z 之外的内置变量名 (in inL inR env vel bend lfo1 lfo2 cc0..cc127) 是后来加入的，旧公式可能用它们声明了变量，报告为保留名以便改名
+	if (FormulaParser::temp_vars.count(name) != 0 && name.size() == 1)
+		msg = "Cannot redefine built-in variable " + name + ".";
+	else if (FormulaParser::temp_vars.count(name) != 0)
+		msg = name + " is a reserved name (built-in input or modulation variable); rename this variable.";
+	else if (FormulaParser::function_dictionary.count(name) != 0)
+		msg = "Cannot use function name " + name + " as a variable.";
+	else if (context.bindings.count(name) != 0 || context.states.count(name) != 0)
+		msg = "Variable " + name + " is already defined.";
+	else
+		return true;
+	return false;
+}
+
+
+// 两种解析器共用的 IR 构造，保证对同一公式得到相同的 (已化简的) 表达式树
+shared_ptr<Expression> fparse::makeOperation(Operation op, shared_ptr<Expression> lhs, shared_ptr<Expression> rhs, bool float_mode, bool simplify) {
+	if (!simplify)
+		return make_shared<CompoundExpression>(op, lhs, rhs);
+
+	// 浮点模式只化简两侧均为常数的运算 (x * 0 等恒等式对 NaN 与无穷大不成立)
+	if (float_mode) {
+		auto l = dynamic_pointer_cast<Constant>(lhs);
+		auto r = dynamic_pointer_cast<Constant>(rhs);
+		if (l != nullptr && r != nullptr) {
+			float value = applyFloatOperation(op, l->float_value, r->float_value);
+			return make_shared<Constant>(fastmath::toInt(value), value);
+		}
+		return make_shared<CompoundExpression>(op, lhs, rhs);
+	}
+
+	switch (op) {
+	case Operation::ADD: return lhs + rhs;
+	case Operation::SUBTRACT: return lhs - rhs;
+	case Operation::MULTIPLY: return lhs * rhs;
+	case Operation::DIVIDE: return lhs / rhs;
+	case Operation::MOD: return lhs % rhs;
+	case Operation::AND: return lhs & rhs;
+	case Operation::OR: return lhs | rhs;
+	case Operation::XOR: return lhs ^ rhs;
+	case Operation::SHIFT_LEFT: return lhs << rhs;
+	case Operation::SHIFT_RIGHT: return lhs >> rhs;
+	default: throw invalid_argument("Invalid operation"); // invalid operation
+	}
+}
+
+bool fparse::checkFunctionArity(const string& name, size_t count, string& msg) {
+	// 检查函数的参数量是否合适
+	const FunctionWithBound& function = FormulaParser::function_dictionary.at(name);
+
+	if ((function.lower_bound >= 0 && count < static_cast<size_t>(function.lower_bound)) || (function.upper_bound >= 0 && count > static_cast<size_t>(function.upper_bound))) {
+		msg = "The " + name + " function has an inappropriate number of parameters: " + to_string(count) + ".";
+		return false;
+	}
+	return true;
+}
+
+bool fparse::checkFunctionMode(const string& name, bool float_mode, string& msg) {
+	if (float_mode || FormulaParser::function_dictionary.at(name).function != nullptr)
+		return true;
+	msg = "The " + name + " function is only available in float mode (" + FormulaParser::float_directive + ").";
+	return false;
+}
+
+shared_ptr<Expression> fparse::makeFunctionCall(const string& name, const vector<shared_ptr<Expression>>& args, bool float_mode, bool simplify) {
+	if (simplify && !args.empty()) {
+		bool constant_flag = true;
+
+		// 检查函数的所有参数是否均为常数
+		for (const shared_ptr<Expression>& expr : args)
+			if (!expr->isConstant()) constant_flag = false;
+
+		// 如果所有参数均为常数
+		if (constant_flag && float_mode) {
+			unordered_map<string, FloatResult> empty_map;
+			float value = FormulaParser::function_dictionary.at(name).float_function(args, empty_map, 1)[0];
+			return make_shared<Constant>(fastmath::toInt(value), value);
+		}
+		if (constant_flag) {
+			std::unordered_map<std::string, EvaluationResult> empty_map;	// 空的 unordered_map, 不占用实际空间
+			FunctionType function = FormulaParser::function_dictionary.at(name).function;
+			return make_shared<Constant>(function(args, empty_map, 1)[0]);
+		}
+	}
+
+	return make_shared<FunctionExpression>(name, args);
+}
+
+shared_ptr<Constant> fparse::makeNumber(const string& token, bool float_mode, string& msg) {
+	if (!float_mode) {
+		if (token.find('.') != string::npos) {
+			msg = string("Float literals require the ") + FormulaParser::float_directive + " directive.";
+			return nullptr;
+		}
+		int32_t value = 0;
+		if (from_chars(token.data(), token.data() + token.size(), value).ec == errc::result_out_of_range) {
+			msg = "Integer literal " + token + " is out of the int32 range.";
+			return nullptr;
+		}
+		return make_shared<Constant>(value);
+	}
+
+	float value = 0.f;
+	istringstream stream(token);		// 不受全局 locale 的小数点影响
+	stream.imbue(locale::classic());
+	stream >> value;
+	return make_shared<Constant>(fastmath::toInt(value), value);
+}
+
+shared_ptr<Expression> fparse::resolveVariable(const ParseContext& context, const string& name) {
+	// 绑定为常数的 let 直接展开
+	auto binding = context.bindings.find(name);
+	if (binding != context.bindings.end() && binding->second->isConstant())
+		return binding->second;
+
+	if (FormulaParser::temp_vars.count(name) == 0 && binding == context.bindings.end() && context.states.count(name) == 0)
+		return nullptr;
+
+	return make_shared<Variable>(name);
+}
+
+bool fparse::makeStatement(const ParseContext& context, StatementKind kind, const string& name, shared_ptr<Expression> expr, Statement& statement, string& msg) {
+	// 不带关键字的赋值: 对状态变量为更新，否则等同于 let
+	if (kind == StatementKind::ASSIGN && context.states.count(name) == 0)
+		kind = StatementKind::LET;
+
+	if (kind != StatementKind::ASSIGN && !checkDeclarable(context, name, msg))
+		return false;
+
+	if (kind == StatementKind::STATE && context.float_mode) {
+		msg = "State variables are not supported in float mode.";
+		return false;
+	}
+
+	if (kind == StatementKind::STATE && !expr->isConstant()) {
+		msg = "The initial value of state variable " + name + " must be a constant.";
+		return false;
+	}
+
+	statement = { kind, name, expr };
+	return true;
+}
+
+void fparse::registerStatement(ParseContext& context, const Statement& statement) {
+	switch (statement.kind) {
+	case StatementKind::LET:
+		context.bindings[statement.name] = statement.expr;
+		if (statement.expr->isConstant())	// 常数绑定在引用处直接展开，无需求值
+			return;
+		break;
+	case StatementKind::STATE: context.states[statement.name] = dynamic_pointer_cast<Constant>(statement.expr)->value; break;
+	default: break;
+	}
+	context.statements.push_back(statement);
+}
+
+
+// 多输出公式的公共子表达式
+// 出现在两个及以上输出中的非叶子子树 (以 toString 为结构的键) 提取为 let 绑定 $cse0, $cse1, ...，每个 block 只求值一次
+// 自顶向下替换，先提取最大的公共子树; 被提取的子树内部也继续替换，内层的绑定排在前面
+// 含 rand() 的子树不合并，各输出中的随机数保持相互独立
+namespace {
+	class CommonSubexpressions {
+	public:
+		vector<Statement> statements;						// 提取出的 let 绑定，按依赖顺序
+
+		explicit CommonSubexpressions(const vector<shared_ptr<Expression>>& outputs) {
+			for (size_t i = 0; i < outputs.size(); i++)
+				collect(*outputs[i], i);
+		}
+
+		shared_ptr<Expression> rewrite(const shared_ptr<Expression>& expr) {
+			auto compound = dynamic_pointer_cast<CompoundExpression>(expr);
+			auto function = dynamic_pointer_cast<FunctionExpression>(expr);
+			if (compound == nullptr && function == nullptr)	// 叶子
+				return expr;
+
+			string key = expr->toString();
+			auto occurrence = occurrences.find(key);
+			bool shared = occurrence != occurrences.end() && occurrence->second.outputs >= 2;
+			if (shared) {
+				auto name = names.find(key);
+				if (name != names.end())
+					return make_shared<Variable>(name->second);
+			}
+
+			shared_ptr<Expression> result = expr;
+			if (compound != nullptr) {
+				auto lhs = rewrite(compound->l);
+				auto rhs = rewrite(compound->r);
+				if (lhs != compound->l || rhs != compound->r)
+					result = make_shared<CompoundExpression>(compound->operation, lhs, rhs);
+			}
+			else {
+				vector<shared_ptr<Expression>> args;
+				for (const shared_ptr<Expression>& arg : function->args)
+					args.push_back(rewrite(arg));
+				if (args != function->args)
+					result = make_shared<FunctionExpression>(function->name, args);
+			}
+			result->setPosition(expr->line, expr->col);
+
+			if (!shared)
+				return result;
+			string name = "$cse" + to_string(names.size());		// 源码中的名字不能含 '$'，不会冲突
+			names[key] = name;
+			statements.push_back({ StatementKind::LET, name, result });
+			return make_shared<Variable>(name);
+		}
+
+	private:
+		struct Occurrence {
+			size_t outputs = 0;								// 出现在几个输出中
+			size_t last_output = 0;
+		};
+		unordered_map<string, Occurrence> occurrences;
+		unordered_map<string, string> names;				// 键 -> 绑定名
+
+		// 记录 expr 中所有不含 rand() 的非叶子子树，返回 expr 是否不含 rand()
+		bool collect(const Expression& expr, size_t output) {
+			bool pure;
+			if (auto compound = dynamic_cast<const CompoundExpression*>(&expr)) {
+				bool lhs = collect(*compound->l, output);
+				bool rhs = collect(*compound->r, output);
+				pure = lhs && rhs;
+			}
+			else if (auto function = dynamic_cast<const FunctionExpression*>(&expr)) {
+				pure = function->name != "rand";
+				for (const shared_ptr<Expression>& arg : function->args)
+					pure = collect(*arg, output) && pure;
+			}
+			else
+				return true;
+
+			if (pure) {
+				Occurrence& occurrence = occurrences[expr.toString()];
+				if (occurrence.outputs == 0 || occurrence.last_output != output) {
+					occurrence.outputs++;
+					occurrence.last_output = output;
+				}
+			}
+			return pure;
+		}
+	};
+}
+
+shared_ptr<Program> fparse::makeProgram(const ParseContext& context, const vector<shared_ptr<Expression>>& outputs) {
+	if (outputs.size() == 1)
+		return make_shared<Program>(context.statements, outputs[0], context.float_mode);
+
+	// 提取的绑定排在所有语句之后: 输出看到的是状态变量本 sample 最后一次赋值后的值
+	CommonSubexpressions cse(outputs);
+	vector<shared_ptr<Expression>> rewritten;
+	for (const shared_ptr<Expression>& output : outputs)
+		rewritten.push_back(cse.rewrite(output));
+
+	vector<Statement> statements = context.statements;
+	statements.insert(statements.end(), cse.statements.begin(), cse.statements.end());
+	return make_shared<Program>(statements, rewritten, context.float_mode);
+}
+
+
+// 当前线程正在进行的解析，供 logger 写入错误信息
+static thread_local ParseContext* active_context = nullptr;
+
+
 // 解析器类
-FormulaParser::FormulaParser() : parser(grammar) {
+FormulaParser::FormulaParser(Backend parser_backend, bool simplify_tree) : backend(parser_backend), simplify(simplify_tree) {}
+
+// 编译语法并注册 action / predicate
+// 所有 action 与 predicate 都不含可变的全局状态，只通过 dt 访问本次解析的 ParseContext
+static unique_ptr<peg::parser> buildGrammar() {
+	auto grammar_parser = make_unique<peg::parser>(FormulaParser::grammar);
+	peg::parser& parser = *grammar_parser;
 	assert(static_cast<bool>(parser) == true);		// debug
 
 	// INPUT pattern
-	parser["INPUT"] = [](const SemanticValues& vs) {
-		return castToExpression(vs[0]);
+	parser["INPUT"] = [](const SemanticValues& vs, any& dt) {
+		auto context = any_cast<ParseContext*>(dt);
+		return makeProgram(*context, any_cast<vector<shared_ptr<Expression>>>(vs.back()));
+		};
+
+	// OUTPUT pattern: 单个表达式或 [l, r, ...]
+	parser["OUTPUT"] = [](const SemanticValues& vs) {
+		vector<shared_ptr<Expression>> outputs;
+		for (const any& value : vs)
+			outputs.push_back(castToExpression(value));
+		return outputs;
+		};
+
+	// STATEMENT pattern
+	parser["STATEMENT"] = [](const SemanticValues& vs, any& dt) {
+		// 只有完整匹配 (包括 ';') 的语句才会被登记，之后的 VAR 才能引用它
+		auto context = any_cast<ParseContext*>(dt);
+		auto statement = any_cast<Statement>(vs[0]);
+		registerStatement(*context, statement);
+		return statement;
+		};
+
+	// STATEDECL / LETBINDING / ASSIGNMENT pattern
+	auto declaration = [](StatementKind kind) {
+		return [kind](const SemanticValues& vs, any& dt) {
+			auto context = any_cast<ParseContext*>(dt);
+			Statement statement;
+			string msg;
+			if (!makeStatement(*context, kind, any_cast<string>(vs[0]), castToExpression(vs[1]), statement, msg))
+				throw parse_error(msg.c_str());
+			return statement;
+			};
+		};
+	parser["STATEDECL"] = declaration(StatementKind::STATE);
+	parser["LETBINDING"] = declaration(StatementKind::LET);
+	parser["ASSIGNMENT"] = declaration(StatementKind::ASSIGN);
+
+	// NAME token
+	parser["NAME"] = [](const SemanticValues& vs) {
+		return vs.token_to_string();
 		};
 
 	// EXPRESSION pattern
-	parser["EXPRESSION"] = [](const SemanticValues& vs) {
+	parser["EXPRESSION"] = [](const SemanticValues& vs, any& dt) {
+		auto context = any_cast<ParseContext*>(dt);
 		auto result = castToExpression(vs[0]);
 		if (vs.size() > 1) {
-			auto ope = any_cast<char>(vs[1]);
+			auto lhs = result;
+			auto ope = any_cast<OperatorToken>(vs[1]);
 			auto expr = castToExpression(vs[2]);
-			switch (ope) {
-			case '+': result = result + expr; break;
-			case '-': result = result - expr; break;
-			case '*': result = result * expr; break;
-			case '/': result = result / expr; break;
-			case '%': result = result % expr; break;
-			case '&': result = result & expr; break;
-			case '|': result = result | expr; break;
-			case '^': result = result ^ expr; break;
-			case '<': result = result << expr; break;
-			case '>': result = result >> expr; break;
+			switch (ope.symbol) {
+			case '+': result = makeOperation(Operation::ADD, result, expr, context->float_mode, context->simplify); break;
+			case '-': result = makeOperation(Operation::SUBTRACT, result, expr, context->float_mode, context->simplify); break;
+			case '*': result = makeOperation(Operation::MULTIPLY, result, expr, context->float_mode, context->simplify); break;
+			case '/': result = makeOperation(Operation::DIVIDE, result, expr, context->float_mode, context->simplify); break;
+			case '%': result = makeOperation(Operation::MOD, result, expr, context->float_mode, context->simplify); break;
+			case '&': result = makeOperation(Operation::AND, result, expr, context->float_mode, context->simplify); break;
+			case '|': result = makeOperation(Operation::OR, result, expr, context->float_mode, context->simplify); break;
+			case '^': result = makeOperation(Operation::XOR, result, expr, context->float_mode, context->simplify); break;
+			case '<': result = makeOperation(Operation::SHIFT_LEFT, result, expr, context->float_mode, context->simplify); break;
+			case '>': result = makeOperation(Operation::SHIFT_RIGHT, result, expr, context->float_mode, context->simplify); break;
 			}
+			if (result != lhs && result != expr)		// 化简返回了操作数本身时保留其位置
+				result->setPosition(ope.line, ope.col);
 		}
 		return result;
 		};
 
 	// FUNCCALL pattern
-	parser["FUNCCALL"] = [](const SemanticValues& vs) -> shared_ptr<Expression> {
+	parser["FUNCCALL"] = [](const SemanticValues& vs, any& dt) -> shared_ptr<Expression> {
+		auto context = any_cast<ParseContext*>(dt);
 		auto name = any_cast<string>(vs[0]);
 
 		vector<shared_ptr<Expression>> args;
+		for (size_t i = 1; i < vs.size(); i++)
+			args.push_back(castToExpression(vs[i]));	// 添加参数
 
-		if (vs.size() > 1) {
-			bool constant_flag = true;
-
-			for (size_t i = 1; i < vs.size(); i++) {
-				shared_ptr<Expression> expr = castToExpression(vs[i]);
-				// 添加参数
-				args.push_back(expr);
-				// 检查函数的所有参数是否均为常数
-				if (!expr->isConstant()) constant_flag = false;
-			}
-
-			// 如果所有参数均为常数
-			if (constant_flag) {
-				std::unordered_map<std::string, EvaluationResult> empty_map;	// 空的 unordered_map, 不占用实际空间
-				FunctionType function = FormulaParser::function_dictionary.at(name).function;
-				return make_shared<Constant>(function(args, empty_map, 1)[0]);
-			}
-		}
-
-		return make_shared<FunctionExpression>(name, args);
+		auto result = makeFunctionCall(name, args, context->float_mode, context->simplify);
+		result->setPosition(vs.line_info().first, vs.line_info().second);
+		return result;
 		};
 
-	parser["FUNCCALL"].predicate = [](const SemanticValues& vs, const any&, string& msg) {
+	parser["FUNCCALL"].predicate = [](const SemanticValues& vs, const any& dt, string& msg) {
+		auto context = any_cast<ParseContext*>(dt);
 		auto name = any_cast<string>(vs[0]);
-
-		// 检查函数的参数量是否合适
-		FunctionWithBound function = FormulaParser::function_dictionary.at(name);
-
-		if ((function.lower_bound >= 0 && vs.size() - 1 < function.lower_bound) || (function.upper_bound >= 0 && vs.size() - 1 > function.upper_bound)) {
-			msg = "The " + name + " function has an inappropriate number of parameters: " + to_string(vs.size() - 1) + ".";
-			return false;
-		}
-		return true;
+		return checkFunctionArity(name, vs.size() - 1, msg) && checkFunctionMode(name, context->float_mode, msg);
 		};
 
 	// OPERATOR token
 	parser["OPERATOR"] = [](const SemanticValues& vs) {
-		return vs.token_to_string()[0];
+		return OperatorToken{ vs.token_to_string()[0], vs.line_info().first, vs.line_info().second };
 		};
 
 	// NUMBER token
-	parser["NUMBER"] = [](const SemanticValues& vs) {
-		return make_shared<Constant>(vs.token_to_number<int32_t>());
+	parser["NUMBER"] = [](const SemanticValues& vs, any& dt) {
+		auto context = any_cast<ParseContext*>(dt);
+		string msg;
+		return makeNumber(vs.token_to_string(), context->float_mode, msg);
+		};
+
+	parser["NUMBER"].predicate = [](const SemanticValues& vs, const any& dt, string& msg) {
+		auto context = any_cast<ParseContext*>(dt);
+		return makeNumber(vs.token_to_string(), context->float_mode, msg) != nullptr;
 		};
 
 	// VAR token
-	parser["VAR"] = [](const SemanticValues& vs) {
-		return make_shared<Variable>(vs.token_to_string());
+	parser["VAR"] = [](const SemanticValues& vs, any& dt) -> shared_ptr<Expression> {
+		auto context = any_cast<ParseContext*>(dt);
+		return resolveVariable(*context, vs.token_to_string());
 		};
 
-	parser["VAR"].predicate = [](const SemanticValues& vs, const any&, string& msg) {
-		// 检查是否存在该名字的函数
+	parser["VAR"].predicate = [](const SemanticValues& vs, const any& dt, string& msg) {
+		// 检查是否存在该名字的变量
+		auto context = any_cast<ParseContext*>(dt);
 		auto name = any_cast<string>(vs.token_to_string());
 
-		if (FormulaParser::temp_vars.count(name) == 0) {
+		if (resolveVariable(*context, name) == nullptr) {
 			msg = "Unknown variable " + name + ".";
 			return false;
 		};
@@ -501,29 +1585,84 @@ FormulaParser::FormulaParser() : parser(grammar) {
 		};
 
 	parser.enable_packrat_parsing();
-};
 
-ParseResult FormulaParser::parse(string& input) noexcept {
+	parser.set_logger([](size_t line, size_t col, const string& msg, const string& rule) {
+		if (active_context != nullptr)
+			active_context->errors.push_back({ line, col, msg, rule });
+		});
+
+	// 先完成一次解析，peglib 中延迟初始化的部分在共享之前全部完成
+	ParseContext warmup_context;
+	any dt = &warmup_context;
+	shared_ptr<Program> warmup_program;
+	parser.parse("let a = t; a", dt, warmup_program);
 
-	ParseResult result = { false, nullptr, 0, 0, "", "" };
+	return grammar_parser;
+}
 
-	parser.set_logger([&result](size_t line, size_t col, const string& msg, const string& rule) {
-		result = { false, nullptr, line,  col, msg, rule };
-		});
+const peg::parser& FormulaParser::getGrammar() {
+	static const unique_ptr<peg::parser> shared_grammar = buildGrammar();	// 线程安全的一次性初始化
+	return *shared_grammar;
+}
 
-	shared_ptr<Expression> expr;
+const char* FormulaParser::float_directive = "#float";
+
+// 源码开头 (之前只有空白) 的 #float 指令的位置，没有时返回 npos
+static size_t findFloatDirective(const string& input) {
+	size_t start = input.find_first_not_of(" \t\n\r");
+	size_t length = strlen(FormulaParser::float_directive);
+	if (start == string::npos || input.compare(start, length, FormulaParser::float_directive) != 0)
+		return string::npos;
+	if (start + length < input.size() && (isalnum(static_cast<unsigned char>(input[start + length])) || input[start + length] == '_'))
+		return string::npos;
+	return start;
+}
+
+ParseResult FormulaParser::parse(const string& input) const noexcept {
+	// 指令替换为等长的空白后交给解析器，错误信息中的行列号不变
+	size_t directive = findFloatDirective(input);
+	bool float_mode = directive != string::npos;
+	string source;
+	if (float_mode)
+		source = string(input).replace(directive, strlen(float_directive), strlen(float_directive), ' ');
+
+	const string& text = float_mode ? source : input;
+	ParseResult result = backend == Backend::PRATT ? PrattParser::parse(text, float_mode, simplify) : parsePeg(text, float_mode);
+	if (result.success)
+		result.cost = estimateCost(*result.program, *OperatorCosts::getCurrent());
+	return result;
+}
+
+ParseResult FormulaParser::parsePeg(const string& input, bool float_mode) const noexcept {
+
+	ParseResult result = { false, nullptr, nullptr, 0, 0, "", "" };
+
+	ParseContext context;
+	context.float_mode = float_mode;
+	context.simplify = simplify;
+	any dt = &context;
+	shared_ptr<Program> program;
+
+	ParseContext* outer_context = active_context;
+	active_context = &context;
 
 	try {
-		bool parse_success = parser.parse(input, expr);		// logger 在此处被调用
+		bool parse_success = getGrammar().parse(input, dt, program);	// logger 在此处被调用
 		if (parse_success)
-			result = { true, expr, 0,  0, "", "" };			// 解析错误不会作为异常被抛出
+			result = { true, program->expr, program, 0,  0, "", "" };	// 解析错误不会作为异常被抛出
+		else if (!context.errors.empty()) {
+			const ParseError& error = context.errors.back();
+			result = { false, nullptr, nullptr, error.line, error.col, error.msg, error.rule };
+		}
 	}
 	catch (const std::exception& e) {						// 标准异常
-		result = { false, nullptr, 0,  0, e.what(), "" };
+		result = { false, nullptr, nullptr, 0,  0, e.what(), "" };
 	}
 	catch (...) {											// 未知的潜在异常
-		result = { false, nullptr, 0,  0, "Unknown Exception", "" };
+		result = { false, nullptr, nullptr, 0,  0, "Unknown Exception", "" };
 	}
 
+	active_context = outer_context;
+
 	return result;
 };
\ No newline at end of file
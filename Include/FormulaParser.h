@@ -1,9 +1,11 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <climits>
 #include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <peglib.h>
@@ -26,6 +28,36 @@ namespace fparse {
 	};
 
 	using EvaluationResult = xt::xarray<int32_t>;
+	using NarrowResult8 = xt::xarray<uint8_t>;											// 窄 lane 求值结果，只保证低 8 位正确
+	using NarrowResult16 = xt::xarray<uint16_t>;										// 只保证低 16 位正确
+	using FloatResult = xt::xarray<float>;												// 浮点模式 (#float) 的求值结果
+
+	// 整数运算的语义 (常数化简、int32 求值与窄 lane 求值一致，没有未定义行为):
+	//   + - * <<       按 two's complement 回绕 (在 uint32 中计算)
+	//   / %            向零取整; 除数为 0 时结果为 0; INT32_MIN / -1 回绕为 INT32_MIN，INT32_MIN % -1 为 0
+	//   << >>          移位量为 rhs & 15，>> 为算术右移
+	int32_t applyOperation(Operation operation, int32_t lhs, int32_t rhs);
+
+	// 浮点模式中的运算:
+	//   + - *          float 运算
+	//   / %            除数为 0 时结果为 0; % 的结果与被除数同号 (同 fmod)
+	//   & | ^ << >>    两侧转换为 int32 (向零取整，见 fastmath::toInt) 后按整数语义计算，再转换回 float
+	float applyFloatOperation(Operation operation, float lhs, float rhs);
+
+	// 值域 (闭区间)，用于证明节点的结果能放进更窄的整数
+	struct ValueRange {
+		int64_t lo;
+		int64_t hi;
+
+		static ValueRange full() { return { INT32_MIN, INT32_MAX }; }
+		static ValueRange of(int64_t lo, int64_t hi) {									// 超出 int32 (运算会回绕) 时退化为 full
+			return (lo < INT32_MIN || hi > INT32_MAX) ? full() : ValueRange{ lo, hi };
+		}
+		bool fitsUnsigned(int bits) const { return lo >= 0 && hi < (int64_t(1) << bits); }
+		bool fitsSigned(int bits) const { return lo >= -(int64_t(1) << (bits - 1)) && hi < (int64_t(1) << (bits - 1)); }
+	};
+
+	using RangeMap = std::unordered_map<std::string, ValueRange>;
 
 	// ±í´ïÊ½»ùÀà
 	class Expression {
@@ -34,16 +66,37 @@ namespace fparse {
 		virtual std::string toString() const = 0;											// debug
 		virtual bool isConstant() const = 0;											// constant simplify
 		virtual EvaluationResult evaluate(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const = 0;	// evaluation
+
+		virtual ValueRange range(const RangeMap& ranges) const = 0;						// 值域分析
+		virtual bool isModular() const { return false; }									// 结果的低 k 位是否只取决于操作数的低 k 位
+		virtual void annotateLanes(const RangeMap& ranges, bool enabled) {}				// 为值域足够小的节点选择窄 lane
+		virtual NarrowResult8 evaluate8(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const;		// 只保证低 8 位正确
+		virtual NarrowResult16 evaluate16(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const;	// 只保证低 16 位正确
+		virtual FloatResult evaluateFloat(const std::unordered_map<std::string, FloatResult>& vars, size_t block_size) const = 0;	// 浮点模式
+		virtual int32_t evaluateScalar(const int32_t* slots) const = 0;					// 单个 sample 的求值，变量按槽位下标读取 (见 Program::bindSlots)，不分配内存
+
+		size_t line = 0;																	// 在源码中的位置 (从 1 开始，0 表示未知)
+		size_t col = 0;
+		void setPosition(size_t source_line, size_t source_col) {							// 只设置尚未设置的位置 (化简可能返回已有的节点)
+			if (line == 0) {
+				line = source_line;
+				col = source_col;
+			}
+		}
 	};
 
 	// ÄäÃûº¯ÊýµÄÀàÐÍ
 	using FunctionType = std::function<EvaluationResult(const std::vector<std::shared_ptr<Expression>>&, const std::unordered_map<std::string, EvaluationResult>&, size_t)>;
+	using FloatFunctionType = std::function<FloatResult(const std::vector<std::shared_ptr<Expression>>&, const std::unordered_map<std::string, FloatResult>&, size_t)>;
+	using ScalarFunctionType = int32_t(*)(const int32_t* args);						// 参数已求值
 
 	// ÄäÃûº¯ÊýµÄº¯Êý²ÎÊý¶¨ÒåÀàÐÍ
 	struct FunctionWithBound {
 		FunctionType function;	// º¯Êý±¾Ìå
 		int16_t lower_bound;	// ²ÎÊýÁ¿ÉÏ½ç
 		int16_t upper_bound;	// ²ÎÊýÁ¿ÏÂ½ç
+		FloatFunctionType float_function;	// 浮点模式的实现 (function 为空的函数只能在浮点模式中使用)
+		ScalarFunctionType scalar_function = nullptr;	// 单个 sample 的实现 (含状态变量的公式使用)，与 function 逐位一致
 	};
 
 
@@ -51,24 +104,37 @@ namespace fparse {
 	class Variable : public Expression {
 	public:
 		std::string name;																	// Var name
+		int slot = -1;																		// 单个 sample 求值时的槽位下标 (只在含状态变量的 Program 中分配)
 
 		Variable(const std::string& name);
 		~Variable() override {};
 		bool isConstant() const override { return false; }								// constant simplify
 		std::string toString() const override;												// debug
 		EvaluationResult evaluate(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;	// evaluation
+		ValueRange range(const RangeMap& ranges) const override;
+		NarrowResult8 evaluate8(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;
+		NarrowResult16 evaluate16(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;
+		FloatResult evaluateFloat(const std::unordered_map<std::string, FloatResult>& vars, size_t block_size) const override;
+		int32_t evaluateScalar(const int32_t* slots) const override { return slots[slot]; }
 	};
 
 	// ³£Á¿Àà
 	class Constant : public Expression {
 	public:
 		int32_t value;
+		float float_value;																	// 浮点模式中的值 (整数字面量为 value 本身)
 
 		Constant(int32_t value);
+		Constant(int32_t value, float float_value);
 		~Constant() override {}
 		bool isConstant() const override { return true; }								// constant simplify
 		std::string toString() const override;												// debug
 		EvaluationResult evaluate(const std::unordered_map<std::string, EvaluationResult>&, size_t block_size) const override;			// evaluation
+		ValueRange range(const RangeMap&) const override { return { value, value }; }
+		NarrowResult8 evaluate8(const std::unordered_map<std::string, EvaluationResult>&, size_t block_size) const override;
+		NarrowResult16 evaluate16(const std::unordered_map<std::string, EvaluationResult>&, size_t block_size) const override;
+		FloatResult evaluateFloat(const std::unordered_map<std::string, FloatResult>&, size_t block_size) const override;
+		int32_t evaluateScalar(const int32_t*) const override { return value; }
 	};
 
 	// ¶þÔª±í´ïÊ½Àà
@@ -77,11 +143,26 @@ namespace fparse {
 		std::shared_ptr<Expression> l, r;													// operands
 		Operation operation;
 
+		uint8_t lane_bits = 32;																// 8 / 16: 在窄 lane 中求值后扩展回 int32
+		bool lane_signed = false;															// 扩展时是否符号扩展
+
 		CompoundExpression(Operation op, std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs);
 		~CompoundExpression() override {}
 		bool isConstant() const override { return false; }								// constant simplify
 		std::string toString() const override;												// debug
 		EvaluationResult evaluate(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;	// evaluation
+		ValueRange range(const RangeMap& ranges) const override;
+		bool isModular() const override;
+		void annotateLanes(const RangeMap& ranges, bool enabled) override;
+		NarrowResult8 evaluate8(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;
+		NarrowResult16 evaluate16(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;
+		FloatResult evaluateFloat(const std::unordered_map<std::string, FloatResult>& vars, size_t block_size) const override;
+		int32_t evaluateScalar(const int32_t* slots) const override;						// 总是在 int32 中求值 (lane 只影响向量求值的速度，不影响结果)
+
+	private:
+		EvaluationResult evaluateWide(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const;
+		template <typename Lane>
+		xt::xarray<Lane> evaluateNarrow(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const;
 	};
 
 	// º¯Êý±í´ïÊ½Àà
@@ -96,33 +177,166 @@ namespace fparse {
 		bool isConstant() const override { return false; }								// constant simplify
 		std::string toString() const override;												// debug
 		EvaluationResult evaluate(const std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size) const override;	// evaluation
+		ValueRange range(const RangeMap& ranges) const override;
+		void annotateLanes(const RangeMap& ranges, bool enabled) override;
+		FloatResult evaluateFloat(const std::unordered_map<std::string, FloatResult>& vars, size_t block_size) const override;
+		int32_t evaluateScalar(const int32_t* slots) const override;
+	};
+
+	// 语句类型
+	enum class StatementKind {
+		LET,		// let a = ...;		每个 block 求值一次的局部绑定
+		STATE,		// state s = 常数;	每个 voice 持久保存的状态变量声明
+		ASSIGN		// s = ...;			逐 sample 更新状态变量
+	};
+
+	// 语句
+	struct Statement {
+		StatementKind kind;
+		std::string name;																	// 绑定 / 状态变量名
+		std::shared_ptr<Expression> expr;													// 绑定值 / 初始值 / 更新值
+	};
+
+	// 多语句公式
+	// 无状态变量时: 每个 let 绑定在每个 block 中整体求值一次，写入 vars 中同名的槽位，随后的语句与输出表达式直接复用
+	// 有状态变量时: 所有语句逐 sample 顺序执行，状态变量在 sample 之间以及 block 之间保持，读取的总是最近一次赋值
+	//               每个 sample 经 evaluateScalar 在 int32 槽位中求值，变量名在构造时解析为槽位下标 (bindSlots)
+	// 浮点模式 (源码首行为 #float): 所有节点在 float 中求值，输出直接为 -1..1; 不支持状态变量
+	// 多输出 ([l, r]): 每个输出对应一个声道，各输出共有的子表达式在解析时提取为 let 绑定 (见 makeProgram)
+	class Program {
+	public:
+		std::vector<Statement> statements;												// 按源码顺序
+		std::vector<std::shared_ptr<Expression>> outputs;									// 输出表达式 (至少一个)
+		std::shared_ptr<Expression> expr;													// 第一个输出表达式
+		bool sequential = false;															// 是否含有状态变量
+		RangeMap ranges;																	// 内置变量与各 let 绑定的值域
+		bool lanes_enabled = true;															// 是否使用窄 lane 求值
+		bool float_mode = false;															// 浮点模式
+		std::unordered_set<std::string> variables;											// 公式用到的内置变量 (插件只计算用到的调制源)
+		std::vector<std::string> slot_names;												// 单个 sample 求值的槽位对应的变量名 (只在含状态变量时非空)
+
+		Program(std::vector<Statement> program_statements, std::shared_ptr<Expression> output_expr, bool float_program = false);
+		Program(std::vector<Statement> program_statements, std::vector<std::shared_ptr<Expression>> output_exprs, bool float_program = false);
+		std::string toString() const;														// debug
+		void resetState(std::unordered_map<std::string, EvaluationResult>& vars) const;	// 将状态变量恢复为初始值 (note on)
+		void setLanesEnabled(bool enabled);													// 关闭时所有节点都在 int32 中求值 (用于对照验证)
+		bool uses(const std::string& name) const { return variables.count(name) != 0; }
+
+		// evaluation
+		// 结果只保证低 output_bits 位正确: 输出只取低位时，顶层的回绕运算可以在 uint8 / uint16 lane 中进行
+		// 浮点模式的 Program 也可经此求值: 输出 -1..1 换算为 0..255 (供工具与对照验证使用，插件直接调用 evaluateFloatOutputs)
+		// evaluateOutputs 将每个输出写入 results 中对应的元素; evaluate 只返回第一个输出 (仍会求值所有输出)
+		void evaluateOutputs(std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size, std::vector<EvaluationResult>& results, int output_bits = 8) const;
+		EvaluationResult evaluate(std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size, int output_bits = 8) const;
+
+		// 浮点模式的求值: inputs 中公式用到的内置变量转换为 float 写入 vars，let 绑定写入 vars 中同名的槽位
+		// vars 由调用者保存并跨 block 复用 (形状不变时不会重新分配内存); 输出未经截断，可能超出 -1..1
+		void evaluateFloatOutputs(const std::unordered_map<std::string, EvaluationResult>& inputs, std::unordered_map<std::string, FloatResult>& vars, size_t block_size, std::vector<FloatResult>& results) const;
+
+	private:
+		void initState(std::unordered_map<std::string, EvaluationResult>& vars, bool reset) const;
+		void evaluateSequential(std::unordered_map<std::string, EvaluationResult>& vars, size_t block_size, std::vector<EvaluationResult>& results) const;
+		void bindSlots();																	// 为各 Variable 节点分配槽位下标
+		std::vector<int> statement_slots;													// 与 statements 对应: 每条语句写入的槽位
+	};
+
+	// 单个节点的 profile 数据
+	struct NodeProfile {
+		uint64_t calls = 0;																	// 求值次数
+		uint64_t samples = 0;																// 求值的 sample 数
+		double inclusive_ns = 0.;															// 含子节点的耗时
+		double self_ns = 0.;																// 不含子节点的耗时
+	};
+
+	// 逐节点的 profile，以节点地址为键 (节点的源码位置见 Expression::line / col)
+	struct EvaluationProfile {
+		std::unordered_map<const Expression*, NodeProfile> nodes;
+		double total_ns = 0.;																// 所有节点 self_ns 之和
+	};
+
+	// 在当前线程上启用 profile，析构时恢复
+	// 未启用时每个节点的求值只多一次 thread_local 指针的判断
+	class ScopedProfiling {
+	public:
+		explicit ScopedProfiling(EvaluationProfile& profile);
+		~ScopedProfiling();
+
+	private:
+		EvaluationProfile* previous;
+	};
+
+	// 解析错误
+	struct ParseError {
+		size_t line;
+		size_t col;
+		std::string msg;
+		std::string rule;
+	};
+
+	// 单次解析的上下文，经 peglib 的 dt 参数传给各个 action / predicate
+	// 所有随解析变化的状态 (符号表、错误) 都放在这里，共享的语法对象本身不被修改
+	struct ParseContext {
+		std::unordered_map<std::string, std::shared_ptr<Expression>> bindings;				// 已声明的 let 绑定
+		std::unordered_map<std::string, int32_t> states;									// 已声明的状态变量及其初始值
+		std::vector<Statement> statements;
+		std::vector<ParseError> errors;													// logger 报告的错误
+		bool float_mode = false;															// 源码以 #float 指令开头
+		bool simplify = true;																// 化简常数运算与恒等式 (关闭时的树供对照验证作参考)
 	};
 
 	// ½âÎö½á¹û
 	struct ParseResult {
 		bool success;
 		std::shared_ptr<Expression> expr;
+		std::shared_ptr<Program> program;
 		size_t line;
 		size_t col;
 		std::string msg;
 		std::string rule;
+		double cost = 0.;																	// 静态估计的开销: 每个 voice 每个 sample 的 ns 数 (见 FormulaCost.h)
 	};
 
+	// 两种解析器共用的 IR 构造 (常数化简在此完成)
+	// 浮点模式中只折叠常数，不做依赖整数语义的化简 (如 x * 0)
+	std::shared_ptr<Expression> makeOperation(Operation op, std::shared_ptr<Expression> lhs, std::shared_ptr<Expression> rhs, bool float_mode = false, bool simplify = true);
+	std::shared_ptr<Expression> makeFunctionCall(const std::string& name, const std::vector<std::shared_ptr<Expression>>& args, bool float_mode = false, bool simplify = true);
+	std::shared_ptr<Constant> makeNumber(const std::string& token, bool float_mode, std::string& msg);	// 整数模式中带小数部分或超出 int32 的字面量返回 nullptr，msg 为原因
+	bool checkFunctionArity(const std::string& name, size_t count, std::string& msg);
+	bool checkFunctionMode(const std::string& name, bool float_mode, std::string& msg);		// 函数在当前模式中是否可用
+	std::shared_ptr<Expression> resolveVariable(const ParseContext& context, const std::string& name);	// 未知变量返回 nullptr
+	bool makeStatement(const ParseContext& context, StatementKind kind, const std::string& name, std::shared_ptr<Expression> expr, Statement& statement, std::string& msg);
+	void registerStatement(ParseContext& context, const Statement& statement);
+	std::shared_ptr<Program> makeProgram(const ParseContext& context, const std::vector<std::shared_ptr<Expression>>& outputs);	// 多个输出时提取公共子表达式
+
 	// ½âÎöÆ÷Àà
 	class FormulaParser {
 	public:
+		// 解析后端: 手写的优先级爬升解析器，或 peglib (保留用于一致性对照)
+		enum class Backend {
+			PRATT,
+			PEG
+		};
+
 		static const char* grammar;
 
 		static const EvaluationResult sine_table, triangle_table;
 
-		static std::unordered_map<std::string, EvaluationResult> temp_vars;
-		static std::unordered_map<std::string, FunctionWithBound> function_dictionary;
+		static const std::unordered_map<std::string, EvaluationResult> temp_vars;			// 合法的内置变量名
+		static const RangeMap variable_ranges;												// 内置变量的值域
+		static const std::unordered_map<std::string, FunctionWithBound> function_dictionary;	// 合法的函数名及实现
 
-		FormulaParser();
-		ParseResult parse(std::string& input) noexcept;
+		FormulaParser(Backend parser_backend = Backend::PRATT, bool simplify_tree = true);	// 不编译语法，开销可忽略; simplify_tree 为 false 时不化简 (对照验证的参考)
+		static const char* float_directive;													// "#float": 位于源码开头 (之前只允许空白) 时选择浮点模式
+
+		ParseResult parse(const std::string& input) const noexcept;						// 可在多个线程中同时调用
+		Backend getBackend() const { return backend; }
 
 	private:
-		peg::parser parser;
+		Backend backend;
+		bool simplify;
+
+		ParseResult parsePeg(const std::string& input, bool float_mode) const noexcept;
+		static const peg::parser& getGrammar();											// 进程内只编译一次 (首次使用 PEG 后端时)、之后只读共享的语法
 	};
 };
 #endif
\ No newline at end of file
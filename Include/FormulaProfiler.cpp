@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <xtensor/xarray.hpp>
+#include <xtensor/xbuilder.hpp>
+
+#include "FormulaProfiler.h"
+
+using namespace fparse;
+using namespace std;
+
+EvaluationProfile fparse::profileProgram(const Program& program, size_t block_size, size_t blocks) {
+	EvaluationProfile profile;
+	unordered_map<string, EvaluationResult> vars;
+	for (const char* macro : { "w", "x", "y", "z" })
+		vars[macro] = EvaluationResult({ 0 });
+	for (const char* input : { "in", "inL", "inR" })		// 静音的输入
+		vars[input] = EvaluationResult({ 128 });
+	for (const string& name : program.variables)			// 调制源取 0
+		if (vars.count(name) == 0)
+			vars[name] = EvaluationResult({ 0 });
+	program.resetState(vars);
+
+	ScopedProfiling profiling(profile);
+	for (size_t block = 0; block < blocks; block++) {
+		int32_t start = static_cast<int32_t>(block * block_size);
+		vars["t"] = xt::arange<int32_t>(start, start + static_cast<int32_t>(block_size));
+		vars["T"] = vars["t"] / 4;
+		program.evaluate(vars, block_size);
+	}
+	return profile;
+}
+
+// 节点的简短描述，过长的表达式截断
+static string describe(const Expression* node) {
+	string text = node->toString();
+	if (text.size() > 48)
+		text = text.substr(0, 45) + "...";
+	return text;
+}
+
+static string formatPercent(double part, double total) {
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "%5.1f%%", total > 0. ? part * 100. / total : 0.);
+	return buffer;
+}
+
+string fparse::profileReport(const string& source, const EvaluationProfile& profile) {
+	using Entry = pair<const Expression*, NodeProfile>;
+	vector<Entry> entries(profile.nodes.begin(), profile.nodes.end());
+
+	// 源码标注: 按位置排序，每个节点一行，^ 指向运算符 / 函数名
+	sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return a.first->line != b.first->line ? a.first->line < b.first->line : a.first->col < b.first->col;
+		});
+
+	string report;
+	vector<string> lines;
+	size_t begin = 0;
+	while (begin <= source.size()) {
+		size_t end = source.find('\n', begin);
+		if (end == string::npos)
+			end = source.size();
+		lines.push_back(source.substr(begin, end - begin));
+		begin = end + 1;
+	}
+
+	char prefix[16];
+	size_t next = 0;
+	for (size_t line = 1; line <= lines.size(); line++) {
+		snprintf(prefix, sizeof(prefix), "%4zu | ", line);
+		report += prefix + lines[line - 1] + "\n";
+
+		while (next < entries.size() && entries[next].first->line < line)		// 位置未知的节点 (line == 0) 只在下面的列表中出现
+			next++;
+		for (; next < entries.size() && entries[next].first->line == line; next++) {
+			const auto& [node, node_profile] = entries[next];
+			report += "     | " + string(node->col > 0 ? node->col - 1 : 0, ' ') + "^ "
+				+ formatPercent(node_profile.self_ns, profile.total_ns) + "  " + describe(node) + "\n";
+		}
+	}
+
+	// 按 self 耗时从高到低列出
+	sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return a.second.self_ns > b.second.self_ns;
+		});
+
+	report += "\n  self    incl  ns/sample      calls  line:col  node\n";
+	for (const auto& [node, node_profile] : entries) {
+		char row[96];
+		snprintf(row, sizeof(row), "%s %s %10.2f %10llu  %4zu:%-3zu  ",
+			formatPercent(node_profile.self_ns, profile.total_ns).c_str(),
+			formatPercent(node_profile.inclusive_ns, profile.total_ns).c_str(),
+			node_profile.samples > 0 ? node_profile.self_ns / node_profile.samples : 0.,
+			static_cast<unsigned long long>(node_profile.calls), node->line, node->col);
+		report += row + describe(node) + "\n";
+	}
+
+	char total[64];
+	snprintf(total, sizeof(total), "\ntotal %.3f ms\n", profile.total_ns * 1.0e-6);
+	report += total;
+	return report;
+}
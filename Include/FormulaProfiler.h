@@ -0,0 +1,18 @@
+#ifndef FORMULA_PROFILER_H
+#define FORMULA_PROFILER_H
+
+#include <cstddef>
+#include <string>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 以合成的输入 (t / T 从 0 递增，宏为 0) 求值 blocks 个 block，记录逐节点的 profile
+	// 在调用线程上同步执行，用于离线分析 (CLI、editor 中的按钮)，不在 audio thread 上使用
+	EvaluationProfile profileProgram(const Program& program, size_t block_size = 512, size_t blocks = 200);
+
+	// 在源码的每一行下标注该行上各节点的 self 耗时占比，其后按占比列出所有节点
+	// profile 中的节点指针必须仍然有效 (对应的 Program 未被释放)
+	std::string profileReport(const std::string& source, const EvaluationProfile& profile);
+};
+#endif
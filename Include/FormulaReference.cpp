@@ -0,0 +1,227 @@
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FormulaReference.h"
+
+using namespace fparse;
+using namespace std;
+
+int32_t fparse::referenceOperation(Operation operation, int32_t lhs, int32_t rhs) {
+	uint32_t a = static_cast<uint32_t>(lhs);
+	uint32_t b = static_cast<uint32_t>(rhs);
+
+	switch (operation) {
+	case Operation::ADD: return static_cast<int32_t>(a + b);
+	case Operation::SUBTRACT: return static_cast<int32_t>(a - b);
+	case Operation::MULTIPLY: return static_cast<int32_t>(a * b);
+	case Operation::DIVIDE:
+		if (rhs == 0)
+			return 0;
+		if (lhs == INT32_MIN && rhs == -1)		// 商 2^31 回绕
+			return INT32_MIN;
+		return lhs / rhs;
+	case Operation::MOD:
+		if (rhs == 0 || (lhs == INT32_MIN && rhs == -1))
+			return 0;
+		return lhs % rhs;
+	case Operation::AND: return lhs & rhs;
+	case Operation::OR: return lhs | rhs;
+	case Operation::XOR: return lhs ^ rhs;
+	case Operation::SHIFT_LEFT: return static_cast<int32_t>(a << (b % 16));		// b % 16 即 rhs 的低 4 位
+	case Operation::SHIFT_RIGHT: return lhs >> (b % 16);
+	default: throw invalid_argument("Invalid operation");
+	}
+}
+
+int32_t fparse::referenceFunction(const string& name, const vector<int32_t>& args, bool& defined) {
+	auto byte = [](int32_t value) { return (value % 256 + 256) % 256; };
+
+	if (name == "sin")
+		return FormulaParser::sine_table[byte(args[0])];
+	if (name == "cos")
+		return FormulaParser::sine_table[byte(static_cast<int32_t>(static_cast<uint32_t>(args[0]) + 64))];
+	if (name == "tri")
+		return FormulaParser::triangle_table[byte(args[0])];
+	if (name == "abs")
+		return args[0] == INT32_MIN ? INT32_MIN : (args[0] < 0 ? -args[0] : args[0]);
+	if (name == "srand") {
+		uint32_t r = (static_cast<uint32_t>(args[0]) + 3463u) * 2971u;
+		r ^= r << 13;
+		r ^= static_cast<uint32_t>(static_cast<int32_t>(r) >> 17);		// int32 的算术右移
+		r ^= r << 5;
+		return static_cast<int32_t>(r);
+	}
+	defined = false;			// rand 及未知的函数
+	return 0;
+}
+
+
+// 参考求值器
+ReferenceEvaluator::ReferenceEvaluator(const Program& reference_program) : program(reference_program) {
+	reset();
+}
+
+void ReferenceEvaluator::reset() {
+	values.clear();
+	for (const Statement& statement : program.statements)
+		if (statement.kind == StatementKind::STATE)
+			values[statement.name] = dynamic_pointer_cast<Constant>(statement.expr)->value;
+}
+
+bool ReferenceEvaluator::evaluate(const unordered_map<string, int32_t>& inputs, int32_t& output) {
+	defined = true;
+	for (const auto& [name, value] : inputs)
+		values[name] = value;
+
+	// 按源码顺序执行; 无状态的公式中 let 整块求值一次与逐 sample 求值等价
+	for (const Statement& statement : program.statements)
+		if (statement.kind != StatementKind::STATE)
+			values[statement.name] = evaluateNode(*statement.expr);
+
+	output = evaluateNode(*program.expr);
+	return defined;
+}
+
+int32_t ReferenceEvaluator::evaluateNode(const Expression& expr) {
+	if (auto constant = dynamic_cast<const Constant*>(&expr))
+		return constant->value;
+	if (auto variable = dynamic_cast<const Variable*>(&expr))
+		return values.at(variable->name);
+	if (auto compound = dynamic_cast<const CompoundExpression*>(&expr)) {
+		int32_t lhs = evaluateNode(*compound->l);
+		int32_t rhs = evaluateNode(*compound->r);
+		return referenceOperation(compound->operation, lhs, rhs);
+	}
+	if (auto function = dynamic_cast<const FunctionExpression*>(&expr)) {
+		vector<int32_t> args;
+		for (const auto& arg : function->args)
+			args.push_back(evaluateNode(*arg));
+		return referenceFunction(function->name, args, defined);
+	}
+	throw invalid_argument("Unknown expression type");
+}
+
+
+// 源码
+static string operatorSymbol(Operation operation) {
+	switch (operation) {
+	case Operation::ADD: return "+";
+	case Operation::SUBTRACT: return "-";
+	case Operation::MULTIPLY: return "*";
+	case Operation::DIVIDE: return "/";
+	case Operation::MOD: return "%";
+	case Operation::AND: return "&";
+	case Operation::OR: return "|";
+	case Operation::XOR: return "^";
+	case Operation::SHIFT_LEFT: return "<<";
+	case Operation::SHIFT_RIGHT: return ">>";
+	default: throw invalid_argument("Invalid operation");
+	}
+}
+
+static string expressionSource(const Expression& expr) {
+	if (auto constant = dynamic_cast<const Constant*>(&expr))
+		return constant->value < 0 ? "(" + to_string(constant->value) + ")" : to_string(constant->value);
+	if (auto variable = dynamic_cast<const Variable*>(&expr))
+		return variable->name;
+	if (auto compound = dynamic_cast<const CompoundExpression*>(&expr))
+		return "(" + expressionSource(*compound->l) + " " + operatorSymbol(compound->operation) + " " + expressionSource(*compound->r) + ")";
+	if (auto function = dynamic_cast<const FunctionExpression*>(&expr)) {
+		string source = function->name + "(";
+		for (size_t i = 0; i < function->args.size(); i++)
+			source += (i > 0 ? ", " : "") + expressionSource(*function->args[i]);
+		return source + ")";
+	}
+	throw invalid_argument("Unknown expression type");
+}
+
+string fparse::programSource(const Program& program) {
+	string source;
+	for (const Statement& statement : program.statements) {
+		switch (statement.kind) {
+		case StatementKind::LET: source += "let "; break;
+		case StatementKind::STATE: source += "state "; break;
+		default: break;
+		}
+		source += statement.name + " = " + expressionSource(*statement.expr) + ";\n";
+	}
+	return source + expressionSource(*program.expr);
+}
+
+
+// 随机公式
+namespace {
+	const int32_t edge_values[] = { 0, 1, -1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 64, 127, 128, 255, 256, 4095, 65535, 65536, INT32_MAX, INT32_MIN, INT32_MIN + 1 };
+	const char* const functions[] = { "sin", "cos", "tri", "abs", "srand" };
+
+	class Generator {
+	public:
+		Generator(mt19937& random, const RandomFormulaOptions& generator_options) : rng(random), options(generator_options) {}
+
+		shared_ptr<Program> program() {
+			vector<Statement> statements;
+			vector<string> states;
+
+			int state_count = options.max_states > 0 && rng() % 3 == 0 ? 1 + int(rng() % options.max_states) : 0;
+			for (int i = 0; i < state_count; i++) {
+				string name = "s" + to_string(i);
+				statements.push_back({ StatementKind::STATE, name, constant() });
+				states.push_back(name);
+				names.push_back(name);
+			}
+
+			int let_count = int(rng() % (options.max_lets + 1));
+			for (int i = 0; i < let_count; i++) {
+				string name = "a" + to_string(i);
+				statements.push_back({ StatementKind::LET, name, expression(options.max_depth) });
+				names.push_back(name);
+			}
+
+			for (const string& name : states)
+				statements.push_back({ StatementKind::ASSIGN, name, expression(options.max_depth) });
+
+			return make_shared<Program>(statements, expression(options.max_depth));
+		}
+
+	private:
+		mt19937& rng;
+		const RandomFormulaOptions& options;
+		vector<string> names = { "t", "T", "w", "x", "y", "z" };
+
+		shared_ptr<Expression> constant() {
+			switch (rng() % 3) {
+			case 0: return make_shared<Constant>(edge_values[rng() % size(edge_values)]);
+			case 1: return make_shared<Constant>(int32_t(rng() % 300));
+			default: return make_shared<Constant>(static_cast<int32_t>(rng()));
+			}
+		}
+
+		shared_ptr<Expression> expression(int depth) {
+			if (depth <= 0 || rng() % 4 == 0) {
+				if (rng() % 5 < 3)
+					return make_shared<Variable>(names[rng() % names.size()]);
+				return constant();
+			}
+
+			if (rng() % 5 == 0) {
+				vector<shared_ptr<Expression>> args = { expression(depth - 1) };
+				return make_shared<FunctionExpression>(functions[rng() % size(functions)], args);
+			}
+
+			Operation operation = static_cast<Operation>(static_cast<int>(Operation::ADD) + int(rng() % 10));
+			shared_ptr<Expression> lhs = expression(depth - 1);
+			shared_ptr<Expression> rhs = expression(depth - 1);
+			return make_shared<CompoundExpression>(operation, lhs, rhs);
+		}
+	};
+}
+
+shared_ptr<Program> fparse::randomProgram(mt19937& rng, const RandomFormulaOptions& options) {
+	return Generator(rng, options).program();
+}
@@ -0,0 +1,56 @@
+#ifndef FORMULA_REFERENCE_H
+#define FORMULA_REFERENCE_H
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 标量参考实现: 逐 sample、逐节点地按公式语义求值，不做化简、不使用 xtensor、不选择 lane
+	// 语义:
+	//   + - *          按 2^32 回绕
+	//   / %            除数为 0 时结果为 0，否则向零取整 (C 的语义); INT32_MIN / -1 为 INT32_MIN，INT32_MIN % -1 为 0
+	//   << >>          移位量为 rhs 的低 4 位，<< 按 2^32 回绕，>> 为算术右移
+	//   sin cos tri    查表，下标为 (x % 256 + 256) % 256，cos 的参数先加 64 (回绕)
+	//   abs            abs(INT32_MIN) 为 INT32_MIN
+	//   输出            取低 8 位 (即 (x % 256 + 256) % 256)
+	// 与引擎的 applyOperation 分别实现，互为对照; rand() 的结果无法复现，referenceFunction 报告为 undefined
+	int32_t referenceOperation(Operation operation, int32_t lhs, int32_t rhs);
+	int32_t referenceFunction(const std::string& name, const std::vector<int32_t>& args, bool& defined);
+
+	// 对一个 Program 逐 sample 求值; 状态变量在 sample 之间保持，reset 恢复为初始值
+	class ReferenceEvaluator {
+	public:
+		explicit ReferenceEvaluator(const Program& reference_program);
+
+		void reset();
+		bool evaluate(const std::unordered_map<std::string, int32_t>& inputs, int32_t& output);	// 结果依赖 rand() 时返回 false
+
+	private:
+		const Program& program;
+		std::unordered_map<std::string, int32_t> values;
+		bool defined = true;
+
+		int32_t evaluateNode(const Expression& expr);
+	};
+
+	// Program 的源码 (每个运算加括号，负常数加括号)，解析后得到语义相同的 Program
+	std::string programSource(const Program& program);
+
+	// 随机公式
+	struct RandomFormulaOptions {
+		int max_depth = 5;																	// 表达式树的最大深度
+		int max_lets = 3;																	// let 绑定的最大数量
+		int max_states = 2;																	// 状态变量的最大数量 (0 时只生成无状态的公式)
+	};
+
+	// 不经化简直接构造的 Program: 作为参考实现的输入，其源码 (programSource) 作为引擎的输入
+	// 叶子偏向边界值 (0、±1、15、16、255、256、INT32_MIN、INT32_MAX 等)，不使用 rand()
+	std::shared_ptr<Program> randomProgram(std::mt19937& rng, const RandomFormulaOptions& options = {});
+};
+#endif
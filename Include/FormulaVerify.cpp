@@ -0,0 +1,507 @@
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <xtensor/xarray.hpp>
+#include <xtensor/xbuilder.hpp>
+#include <xtensor/xrandom.hpp>
+#include <xtensor/xview.hpp>
+
+#include "FloatMath.h"
+#include "FormulaCache.h"
+#include "FormulaReference.h"
+#include "FormulaVerify.h"
+#include "ProgramSerializer.h"
+#include "TransportPosition.h"
+
+using namespace fparse;
+using namespace std;
+
+VerifyReport fparse::verifyLanes(const FormulaParser& parser, const string& formula, int output_bits, size_t block_size, size_t blocks, uint32_t seed) {
+	ParseResult narrow = parser.parse(formula);
+	ParseResult wide = parser.parse(formula);
+	if (!narrow.success || !wide.success)
+		return { false, "Line " + to_string(narrow.line) + ", column " + to_string(narrow.col) + ": " + narrow.msg, 0, 0 };
+
+	wide.program->setLanesEnabled(false);
+
+	unordered_map<string, EvaluationResult> narrow_vars, wide_vars;
+	mt19937 rng(seed);
+	uint32_t mask = output_bits >= 32 ? numeric_limits<uint32_t>::max() : (uint32_t(1) << output_bits) - 1;
+
+	VerifyReport report = { true, "", 0, 0 };
+	for (size_t block = 0; block < blocks; block++) {
+		// 每隔几个 block 换一个起点，其中一部分紧贴 INT32_MAX，覆盖 t 回绕为负数的情况
+		int64_t start = block % 4 == 3 ? int64_t(INT32_MAX) - int64_t(block_size / 2) : int64_t(rng() % (1u << 24));
+		int32_t step = int32_t(rng() % 4) + 1;
+		xt::xarray<int64_t> ramp = start + xt::arange<int64_t>(0, int64_t(block_size)) * step;
+		EvaluationResult t = xt::cast<int32_t>(xt::cast<uint32_t>(ramp));		// 按 int32 回绕
+
+		for (auto* vars : { &narrow_vars, &wide_vars }) {
+			(*vars)["t"] = t;
+			(*vars)["T"] = t / 3;
+		}
+		for (const char* macro : { "w", "x", "y", "z" }) {
+			int32_t value = int32_t(rng() % 256);
+			narrow_vars[macro] = { value };
+			wide_vars[macro] = { value };
+		}
+		for (const char* input : { "in", "inL", "inR" }) {		// 输入音频: 逐 sample 变化的 8 位值
+			EvaluationResult value = xt::cast<int32_t>((t + int32_t(rng() % 256)) & 255);
+			narrow_vars[input] = value;
+			wide_vars[input] = value;
+		}
+		for (const string& name : wide.program->variables) {		// 调制源: 值域内的随机值，整个 block 不变
+			if (name.size() == 1 || name.rfind("in", 0) == 0)		// t T w x y z 与输入音频已在上面设置
+				continue;
+			int32_t value = int32_t(rng() % uint32_t(FormulaParser::variable_ranges.at(name).hi + 1));
+			narrow_vars[name] = { value };
+			wide_vars[name] = { value };
+		}
+
+		vector<EvaluationResult> expected, actual;		// 多输出的公式逐个输出比较
+		xt::random::seed(seed + uint32_t(block));
+		wide.program->evaluateOutputs(wide_vars, block_size, expected, 32);
+		xt::random::seed(seed + uint32_t(block));
+		narrow.program->evaluateOutputs(narrow_vars, block_size, actual, output_bits);
+
+		for (size_t k = 0; k < expected.size(); k++) {
+			for (size_t i = 0; i < block_size; i++) {
+				if ((uint32_t(expected[k][i]) & mask) != (uint32_t(actual[k][i]) & mask)) {
+					if (report.mismatches == 0)
+						report.msg = (expected.size() > 1 ? "output " + to_string(k) + ", " : "") + "block " + to_string(block) + ", sample " + to_string(i) +
+							" (t = " + to_string(t[i]) + "): expected " + to_string(uint32_t(expected[k][i]) & mask) + ", got " + to_string(uint32_t(actual[k][i]) & mask);
+					report.mismatches++;
+					report.success = false;
+				}
+				report.samples++;
+			}
+		}
+	}
+	return report;
+}
+
+
+namespace {
+	// 一个 block 的输入及参考结果
+	struct ReferenceBlock {
+		EvaluationResult t, T;
+		int32_t macros[4];
+		int32_t audio[3];		// in inL inR，整个 block 不变
+		std::unordered_map<std::string, int32_t> modulation;	// 公式用到的调制源 (env vel bend lfo cc)，整个 block 不变
+		std::vector<int32_t> expected;
+	};
+
+	// 一条引擎求值路径，vars 中保存其状态变量
+	struct EnginePath {
+		std::string name;
+		std::shared_ptr<Program> program;
+		int output_bits;
+		bool split;				// block 分为两段求值
+		std::unordered_map<std::string, EvaluationResult> vars;
+	};
+
+	const char* const macro_names[4] = { "w", "x", "y", "z" };
+	const char* const audio_names[3] = { "in", "inL", "inR" };
+}
+
+VerifyReport fparse::verifyReference(const Program& reference, const string& source, const FormulaParser& pratt, const FormulaParser& peg,
+	size_t block_size, size_t blocks, uint32_t seed) {
+	mt19937 rng(seed);
+	VerifyReport report = { true, "", 0, 0 };
+
+	// 参考实现只有整数语义，浮点模式的公式不作对照
+	if (reference.float_mode) {
+		report.skipped = true;
+		return report;
+	}
+
+	// 先求出参考结果; 遇到 rand() 时只比较此前的 block
+	ReferenceEvaluator evaluator(reference);
+	vector<ReferenceBlock> inputs;
+	for (size_t block = 0; block < blocks && !report.skipped; block++) {
+		ReferenceBlock input;
+		int64_t start = block % 4 == 3 ? int64_t(INT32_MAX) - int64_t(block_size / 2) : int64_t(int32_t(rng()));
+		int32_t step = int32_t(rng() % 4) + 1;
+		input.t = xt::cast<int32_t>(xt::cast<uint32_t>(start + xt::arange<int64_t>(0, int64_t(block_size)) * step));		// 按 int32 回绕
+		input.T = xt::cast<int32_t>(xt::cast<uint32_t>(int64_t(int32_t(rng())) + xt::arange<int64_t>(0, int64_t(block_size))));
+		for (int m = 0; m < 4; m++)
+			input.macros[m] = int32_t(rng() % 256);
+
+		for (int a = 0; a < 3; a++)
+			input.audio[a] = int32_t(rng() % 256);
+		for (const string& name : reference.variables)
+			if (name.size() > 1 && name.rfind("in", 0) != 0)
+				input.modulation[name] = int32_t(rng() % uint32_t(FormulaParser::variable_ranges.at(name).hi + 1));
+
+		unordered_map<string, int32_t> sample_inputs;
+		for (int m = 0; m < 4; m++)
+			sample_inputs[macro_names[m]] = input.macros[m];
+		for (int a = 0; a < 3; a++)
+			sample_inputs[audio_names[a]] = input.audio[a];
+		for (const auto& [name, value] : input.modulation)
+			sample_inputs[name] = value;
+
+		input.expected.resize(block_size);
+		for (size_t i = 0; i < block_size && !report.skipped; i++) {
+			sample_inputs["t"] = input.t[i];
+			sample_inputs["T"] = input.T[i];
+			report.skipped = !evaluator.evaluate(sample_inputs, input.expected[i]);
+		}
+		if (!report.skipped)
+			inputs.push_back(input);
+	}
+	if (inputs.empty())
+		return report;
+
+	ParseResult narrow = pratt.parse(source);
+	ParseResult wide = pratt.parse(source);
+	ParseResult peg_result = peg.parse(source);
+	if (!narrow.success || !wide.success)
+		return { false, "PRATT: line " + to_string(narrow.line) + ", column " + to_string(narrow.col) + ": " + narrow.msg, 0, 0 };
+	if (!peg_result.success)
+		return { false, "PEG: line " + to_string(peg_result.line) + ", column " + to_string(peg_result.col) + ": " + peg_result.msg, 0, 0 };
+	wide.program->setLanesEnabled(false);
+
+	shared_ptr<Program> restored = deserializeProgram(serializeProgram(*narrow.program, source), source);
+	if (restored == nullptr)
+		return { false, "Serialized program could not be read back", 0, 0 };
+
+	vector<EnginePath> paths = {
+		{ "lanes/32", narrow.program, 32, false },
+		{ "lanes/16", narrow.program, 16, false },
+		{ "lanes/8", narrow.program, 8, false },
+		{ "int32", wide.program, 32, false },
+		{ "split", narrow.program, 32, true },
+		{ "serialized", restored, 8, false },
+		{ "peg", peg_result.program, 8, false },
+	};
+	for (EnginePath& path : paths)
+		path.program->resetState(path.vars);
+
+	for (size_t block = 0; block < inputs.size(); block++) {
+		const ReferenceBlock& input = inputs[block];
+
+		for (EnginePath& path : paths) {
+			for (int m = 0; m < 4; m++)
+				path.vars[macro_names[m]] = { input.macros[m] };
+			for (int a = 0; a < 3; a++)
+				path.vars[audio_names[a]] = { input.audio[a] };
+			for (const auto& [name, value] : input.modulation)
+				path.vars[name] = { value };
+
+			EvaluationResult actual;
+			if (path.split && block_size >= 4) {
+				size_t split = block_size / 3;
+				path.vars["t"] = xt::view(input.t, xt::range(0, split));
+				path.vars["T"] = xt::view(input.T, xt::range(0, split));
+				EvaluationResult first = path.program->evaluate(path.vars, split, path.output_bits);
+				path.vars["t"] = xt::view(input.t, xt::range(split, block_size));
+				path.vars["T"] = xt::view(input.T, xt::range(split, block_size));
+				EvaluationResult second = path.program->evaluate(path.vars, block_size - split, path.output_bits);
+				actual = xt::concatenate(xt::xtuple(first, second));
+			}
+			else {
+				path.vars["t"] = input.t;
+				path.vars["T"] = input.T;
+				actual = path.program->evaluate(path.vars, block_size, path.output_bits);
+			}
+
+			uint32_t mask = path.output_bits >= 32 ? numeric_limits<uint32_t>::max() : (uint32_t(1) << path.output_bits) - 1;
+			for (size_t i = 0; i < block_size; i++) {
+				uint32_t expected = uint32_t(input.expected[i]) & mask;
+				uint32_t got = uint32_t(actual[i]) & mask;
+				if (expected != got) {
+					if (report.mismatches == 0)
+						report.msg = path.name + ": block " + to_string(block) + ", sample " + to_string(i) + " (t = " + to_string(input.t[i]) +
+							", T = " + to_string(input.T[i]) + "): expected " + to_string(expected) + ", got " + to_string(got);
+					report.mismatches++;
+					report.success = false;
+				}
+				report.samples++;
+			}
+		}
+	}
+	return report;
+}
+
+
+VerifyReport fparse::verifyFolding(size_t random_values, uint32_t seed) {
+	vector<int32_t> values = { 0, 1, -1, 2, -2, 3, 7, 8, 15, 16, 17, -15, -16, -17, 31, 32, 127, 128, 255, 256, 65535, 65536,
+		INT32_MAX, INT32_MAX - 1, INT32_MIN, INT32_MIN + 1 };
+	mt19937 rng(seed);
+	for (size_t i = 0; i < random_values; i++)
+		values.push_back(int32_t(rng()));
+
+	EvaluationResult column = xt::zeros<int32_t>({ values.size() });
+	for (size_t i = 0; i < values.size(); i++)
+		column[i] = values[i];
+
+	// 所有 (a, b) 组合排成一个 block
+	size_t count = values.size() * values.size();
+	EvaluationResult a = xt::zeros<int32_t>({ count }), b = xt::zeros<int32_t>({ count });
+	for (size_t i = 0; i < count; i++) {
+		a[i] = values[i / values.size()];
+		b[i] = values[i % values.size()];
+	}
+	unordered_map<string, EvaluationResult> pair_vars = { { "a", a }, { "b", b } };
+	unordered_map<string, EvaluationResult> column_vars = { { "a", column } };
+
+	VerifyReport report = { true, "", 0, 0 };
+	auto check = [&report](const string& path, const string& expression, int32_t expected, int32_t got, uint32_t mask) {
+		report.samples++;
+		if ((uint32_t(expected) & mask) == (uint32_t(got) & mask))
+			return;
+		if (report.mismatches == 0)
+			report.msg = path + ": " + expression + ": expected " + to_string(int32_t(uint32_t(expected) & mask)) + ", got " + to_string(int32_t(uint32_t(got) & mask));
+		report.mismatches++;
+		report.success = false;
+	};
+	auto source = [](Operation operation, int32_t lhs, int32_t rhs) {
+		return CompoundExpression(operation, make_shared<Constant>(lhs), make_shared<Constant>(rhs)).toString();
+	};
+
+	for (int op = int(Operation::ADD); op <= int(Operation::SHIFT_RIGHT); op++) {
+		Operation operation = static_cast<Operation>(op);
+		auto node = make_shared<CompoundExpression>(operation, make_shared<Variable>("a"), make_shared<Variable>("b"));
+		EvaluationResult wide = node->evaluate(pair_vars, count);		// 未标注 lane，在 int32 中求值
+		bool modular = node->isModular();
+		NarrowResult8 narrow8;
+		NarrowResult16 narrow16;
+		if (modular) {
+			narrow8 = node->evaluate8(pair_vars, count);
+			narrow16 = node->evaluate16(pair_vars, count);
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			int32_t expected = referenceOperation(operation, a[i], b[i]);
+			auto folded = dynamic_pointer_cast<Constant>(makeOperation(operation, make_shared<Constant>(a[i]), make_shared<Constant>(b[i])));
+			if (folded == nullptr) {
+				check("fold", source(operation, a[i], b[i]) + " (not folded)", 0, 1, numeric_limits<uint32_t>::max());
+				continue;
+			}
+			check("fold", source(operation, a[i], b[i]), expected, folded->value, numeric_limits<uint32_t>::max());
+			check("int32", source(operation, a[i], b[i]), expected, wide[i], numeric_limits<uint32_t>::max());
+			if (modular) {
+				check("lanes/8", source(operation, a[i], b[i]), expected, narrow8[i], 0xff);
+				check("lanes/16", source(operation, a[i], b[i]), expected, narrow16[i], 0xffff);
+			}
+		}
+
+		// 窄 lane 中的左移只接受常数移位量
+		if (operation == Operation::SHIFT_LEFT) {
+			for (int32_t shift : values) {
+				CompoundExpression shift_node(operation, make_shared<Variable>("a"), make_shared<Constant>(shift));
+				NarrowResult8 shifted8 = shift_node.evaluate8(column_vars, values.size());
+				NarrowResult16 shifted16 = shift_node.evaluate16(column_vars, values.size());
+				for (size_t i = 0; i < values.size(); i++) {
+					int32_t expected = referenceOperation(operation, values[i], shift);
+					check("lanes/8", source(operation, values[i], shift), expected, shifted8[i], 0xff);
+					check("lanes/16", source(operation, values[i], shift), expected, shifted16[i], 0xffff);
+				}
+			}
+		}
+	}
+
+	for (const char* name : { "sin", "cos", "tri", "abs", "srand" }) {
+		FunctionExpression function(name, { make_shared<Variable>("a") });
+		EvaluationResult result = function.evaluate(column_vars, values.size());
+		for (size_t i = 0; i < values.size(); i++) {
+			bool defined = true;
+			int32_t expected = referenceFunction(name, { values[i] }, defined);
+			check("function", string(name) + "(" + to_string(values[i]) + ")", expected, result[i], numeric_limits<uint32_t>::max());
+		}
+	}
+
+	// 浮点模式: 化简得到的常数与 evaluateFloat 逐位一致 (NaN 视为相同); 位运算的两侧保持在 int32 内
+	vector<float> float_values = { 0.f, -0.f, 1.f, -1.f, 0.5f, -0.5f, 1.5f, -2.75f, 3.25f, 7.9f, 255.5f, -256.25f, 1.0e6f, -1.0e6f };
+	for (size_t i = 0; i < random_values; i++)
+		float_values.push_back(float(int32_t(rng() % 2000001) - 1000000) / 64.f);
+
+	size_t float_count = float_values.size() * float_values.size();
+	FloatResult fa = xt::zeros<float>({ float_count }), fb = xt::zeros<float>({ float_count });
+	for (size_t i = 0; i < float_count; i++) {
+		fa[i] = float_values[i / float_values.size()];
+		fb[i] = float_values[i % float_values.size()];
+	}
+	unordered_map<string, FloatResult> float_vars = { { "a", fa }, { "b", fb } };
+
+	for (int op = int(Operation::ADD); op <= int(Operation::SHIFT_RIGHT); op++) {
+		Operation operation = static_cast<Operation>(op);
+		FloatResult evaluated = CompoundExpression(operation, make_shared<Variable>("a"), make_shared<Variable>("b")).evaluateFloat(float_vars, float_count);
+		for (size_t i = 0; i < float_count; i++) {
+			auto folded = dynamic_pointer_cast<Constant>(makeOperation(operation, make_shared<Constant>(fastmath::toInt(fa[i]), fa[i]), make_shared<Constant>(fastmath::toInt(fb[i]), fb[i]), true));
+			string expression = CompoundExpression(operation, make_shared<Variable>(to_string(fa[i])), make_shared<Variable>(to_string(fb[i]))).toString();
+			report.samples++;
+			bool same = folded != nullptr && (folded->float_value == evaluated[i] || (std::isnan(folded->float_value) && std::isnan(evaluated[i])));
+			if (same)
+				continue;
+			if (report.mismatches == 0)
+				report.msg = "float: " + expression + ": folded " + (folded != nullptr ? to_string(folded->float_value) : string("(not folded)")) + ", evaluated " + to_string(evaluated[i]);
+			report.mismatches++;
+			report.success = false;
+		}
+	}
+
+	// 超出 int32 的整数字面量是解析错误 (浮点模式中仍可使用)
+	for (FormulaParser::Backend backend : { FormulaParser::Backend::PRATT, FormulaParser::Backend::PEG }) {
+		FormulaParser parser(backend);
+		const char* backend_name = backend == FormulaParser::Backend::PRATT ? "pratt" : "peg";
+		for (const char* formula : { "t * 2147483648", "4294967296 >> 8", "-2147483649 + t" }) {
+			report.samples++;
+			if (!parser.parse(formula).success)
+				continue;
+			if (report.mismatches == 0)
+				report.msg = string("literal/") + backend_name + ": " + formula + ": accepted an out-of-range literal";
+			report.mismatches++;
+			report.success = false;
+		}
+		for (const char* formula : { "t * 2147483647", "#float\n(t * 4294967296.5) / 3.5" }) {
+			report.samples++;
+			ParseResult result = parser.parse(formula);
+			if (result.success)
+				continue;
+			if (report.mismatches == 0)
+				report.msg = string("literal/") + backend_name + ": " + formula + ": " + result.msg;
+			report.mismatches++;
+			report.success = false;
+		}
+	}
+	return report;
+}
+
+VerifyReport fparse::verifyTransport(size_t blocks, uint32_t seed) {
+	mt19937 rng(seed);
+	VerifyReport report = { true, "", 0, 0 };
+	const double host_rates[] = { 44100., 48000., 96000. };
+
+	for (int ratio : { 1, 2, 4, 8, 16 }) {
+		for (bool looping : { false, true }) {
+			double host_rate = host_rates[rng() % 3];
+			double bpm = 60. + double(rng() % 120);
+			double loop_start = 4.;
+			double loop_end = loop_start + double(1 + rng() % 8);
+			double start_ppq = looping ? loop_start : double(rng() % 64);
+
+			// 从播放起点起经过 host_samples 个宿主 sample 的精确位置
+			auto exact = [&](double host_samples) {
+				double position = start_ppq + bpm / 60. * host_samples / host_rate;
+				if (looping && position >= loop_end)
+					position = loop_start + fmod(position - loop_start, loop_end - loop_start);
+				return position;
+				};
+
+			int64_t host_position = 0;
+			for (size_t block = 0; block < blocks; block++) {
+				int host_samples = 1 + int(rng() % 1024);
+				int rendered_samples = host_samples * ratio;
+
+				TransportPosition transport;
+				transport.synced = true;
+				transport.ppq = exact(double(host_position));		// 宿主只给出 block 起点的位置
+				transport.looping = looping;
+				transport.loop_start = loop_start;
+				transport.loop_end = loop_end;
+				transport.setSpan(bpm, host_rate, host_samples, rendered_samples);
+
+				auto compare = [&](const string& where, int32_t expected, int32_t got) {
+					double difference = double(int64_t(got) - int64_t(expected));
+					if (looping) {			// 循环终点两侧的舍入可能落在不同的一侧
+						double period = (loop_end - loop_start) * 256.;
+						difference = fmod(fmod(difference, period) + period * 1.5, period) - period * 0.5;
+					}
+					report.samples++;
+					if (fabs(difference) <= 1.)
+						return;
+					if (report.mismatches == 0)
+						report.msg = to_string(ratio) + "x" + (looping ? ", looping" : "") + ", block " + to_string(block) + ", " + where +
+							": expected T = " + to_string(expected) + ", got " + to_string(got);
+					report.mismatches++;
+					report.success = false;
+					};
+
+				for (int i = 0; i < rendered_samples; i++)
+					compare("sample " + to_string(i), TransportPosition::standardTime(exact(double(host_position) + double(i) / ratio)),
+						TransportPosition::standardTime(transport.ppqAt(i)));
+
+				// MIDI 事件 (宿主 block 中的位置) 在渲染的 block 中生效处的 T
+				for (int e = 0; e < 4; e++) {
+					int event = int(rng() % uint32_t(host_samples));
+					int position = TransportPosition::eventPosition(event, ratio, rendered_samples);
+					compare("MIDI event at host sample " + to_string(event), TransportPosition::standardTime(exact(double(host_position + event))),
+						TransportPosition::standardTime(transport.ppqAt(position)));
+				}
+				host_position += host_samples;
+			}
+		}
+	}
+	return report;
+}
+
+VerifyReport fparse::verifyNormalization(size_t variants, uint32_t seed) {
+	static const vector<string> formulas = {
+		"t*(t>>12|t>>8)&63",
+		"t - 1 - -1 << 2 >> 1",
+		"t / 2 * 3 /* comment */ + (t >> 4) // trailing",
+		"let a = t >> 10; let b = (a & 42) * t; b ^ (b >> 8) | sin(a + T)",
+		"state acc = 0; acc = acc + (t >> 8) & 255; acc ^ t",
+		"#float\nsin(t * 0.25) * 1.5",
+		"#float\nt * 1 .5",
+		"#float\nt * 1. 5",
+		"#float\n0.5 * exp(t / 1000.25)",
+		"/* leading */ #float\nt * 0.5",
+		"// leading\n#float\nt * 0.5",
+		"  #float t * 0.5",
+	};
+	static const char* fillers[] = { " ", "\n", "\t ", "/* c */" };
+
+	FormulaParser parser;
+	mt19937 rng(seed);
+	VerifyReport report = { true, "", 0, 0 };
+
+	auto fail = [&](const string& msg) {
+		report.mismatches++;
+		if (report.success) {
+			report.success = false;
+			report.msg = msg;
+		}
+		};
+
+	// 原文与规范文本解析结果相同; 解析结果不同的两个公式 (包括一方失败) 规范文本不同，formulaHash 也不同
+	struct Parsed {
+		string source;
+		uint64_t hash;
+		string tree;			// 解析失败时为空
+	};
+	vector<Parsed> parsed;
+	auto treeOf = [](const ParseResult& result) { return result.success ? result.program->toString() : string(); };
+	auto check = [&](const string& source) {
+		string normalized = normalizeFormula(source);
+		string tree = treeOf(parser.parse(source));
+		report.samples++;
+		if (tree != treeOf(parser.parse(normalized)))
+			fail("\"" + source + "\" normalizes to \"" + normalized + "\", which parses differently");
+		uint64_t hash = formulaHash(source);
+		for (const Parsed& other : parsed)
+			if (other.tree != tree && other.hash == hash)
+				fail("\"" + source + "\" and \"" + other.source + "\" parse differently but have the same hash");
+		parsed.push_back({ source, hash, tree });
+		};
+
+	for (const string& formula : formulas) {
+		check(formula);
+		// 在随机位置插入空白或注释: 可能拆开 token，此时原文与规范文本应同样失败或得到相同的树
+		for (size_t v = 0; v < variants; v++) {
+			string source = formula;
+			for (int k = 0; k < 3; k++)
+				source.insert(rng() % (source.size() + 1), fillers[rng() % 4]);
+			check(source);
+		}
+	}
+	return report;
+}
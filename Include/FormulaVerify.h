@@ -0,0 +1,50 @@
+#ifndef FORMULA_VERIFY_H
+#define FORMULA_VERIFY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 对照验证的结果
+	struct VerifyReport {
+		bool success;				// 公式解析成功且所有 sample 一致
+		std::string msg;			// 解析错误或第一个不一致之处
+		size_t samples;				// 已比较的 sample 数
+		size_t mismatches;
+		bool skipped = false;		// 遇到结果无法复现的 rand() (见 FormulaReference.h)，之后的 sample 未比较; 浮点模式的公式整体跳过
+	};
+
+	// 窄 lane 求值与全 int32 求值的逐位对照
+	// 同一公式解析两次，其中一份关闭窄 lane；两者使用相同的随机输入 (t / T 从随机起点开始，包括接近 int32 回绕的位置；宏取 0..255)，
+	// 在 rand() 前设置相同的随机种子，比较输出的低 output_bits 位
+	VerifyReport verifyLanes(const FormulaParser& parser, const std::string& formula, int output_bits = 8,
+		size_t block_size = 512, size_t blocks = 64, uint32_t seed = 1);
+
+	// 引擎的各条求值路径与标量参考实现 (ReferenceEvaluator) 的逐位对照
+	// reference 为未经化简的 Program，source 为其源码; 引擎路径:
+	//   PRATT 解析 (窄 lane，输出 32 / 16 / 8 位)、关闭窄 lane、block 分为两段求值、序列化后再读入，以及 PEG 解析
+	// 随机输入: t / T 从任意起点 (包括接近 int32 回绕处) 以随机步长递增，宏取 0..255
+	// 参考实现遇到 rand() 时在该 block 之前停止 (skipped)
+	VerifyReport verifyReference(const Program& reference, const std::string& source, const FormulaParser& pratt, const FormulaParser& peg,
+		size_t block_size = 256, size_t blocks = 8, uint32_t seed = 1);
+
+	// 常数化简与运行时求值的逐位对照
+	// 对每个二元运算，在边界值 (0、±1、15、16、INT32_MIN、INT32_MAX 等) 与随机值的所有组合上，比较 makeOperation 化简得到的常数、
+	// int32 求值、窄 lane 求值 (回绕运算，移位量为常数) 与 referenceOperation; 函数 (abs、srand、sin 等) 比较运行时结果与 referenceFunction
+	// 浮点模式 (#float) 中比较化简得到的常数与 evaluateFloat; 两种解析器均须拒绝超出 int32 的整数字面量
+	VerifyReport verifyFolding(size_t random_values = 64, uint32_t seed = 1);
+
+	// 宿主播放位置换算的 T (TransportPosition) 在 block 之间连续
+	// 模拟宿主以随机长度的 block 播放 (过采样 1..16 倍，随机的采样率与速度，有无循环区间)，每个 block 只给出起点的 PPQ 与速度，
+	// 每个渲染的 sample 的 T 与按连续时间计算的精确值比较 (允许 1 的舍入误差，循环终点处按循环长度取模);
+	// block 中随机位置的 MIDI 事件经 eventPosition 换算后，所在 sample 的 T 与事件在宿主中的时刻一致
+	VerifyReport verifyTransport(size_t blocks = 200, uint32_t seed = 1);
+
+	// 规范文本 (normalizeFormula) 不改变分词: 内置的公式集 (含小数、移位、注释与 #float 指令的边界情况) 及其在随机位置
+	// 插入空白或注释的变体，原文与规范文本的解析结果须相同 (同为失败，或得到相同的表达式树)，解析结果不同的公式 formulaHash 也不同
+	VerifyReport verifyNormalization(size_t variants = 32, uint32_t seed = 1);
+};
+#endif
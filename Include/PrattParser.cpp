@@ -0,0 +1,335 @@
+#include <cctype>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PrattParser.h"
+
+using namespace fparse;
+using namespace std;
+
+namespace {
+	// 语法错误，pos 为出错位置在输入中的偏移
+	struct SyntaxError {
+		size_t pos;
+		string msg;
+	};
+
+	// 二元运算符，precedence 与 grammar 中 precedence 的声明顺序一致 (越大结合越紧，均为左结合)
+	struct OperatorInfo {
+		Operation operation;
+		int precedence;
+		size_t length;
+	};
+
+	bool isDigit(char c) { return isdigit(static_cast<unsigned char>(c)) != 0; }
+	bool isIdentifierStart(char c) { return isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+	bool isIdentifierChar(char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+	// 偏移 -> 行列号 (从 1 开始，与 peglib 一致)
+	void lineColumn(const string& text, size_t pos, size_t& line, size_t& col) {
+		line = 1;
+		col = 1;
+		for (size_t i = 0; i < pos && i < text.size(); i++) {
+			if (text[i] == '\n') {
+				line++;
+				col = 1;
+			}
+			else
+				col++;
+		}
+	}
+
+	class Parser {
+	public:
+		Parser(const string& input, ParseContext& parse_context) : text(input), context(parse_context) {}
+
+		// INPUT <- STATEMENT* OUTPUT
+		shared_ptr<Program> parseInput() {
+			skipWhitespace();
+			while (parseStatement()) {}
+
+			vector<shared_ptr<Expression>> outputs = parseOutput();
+
+			skipWhitespace();
+			if (pos < text.size())
+				throw SyntaxError{ pos, "Unexpected '" + string(1, text[pos]) + "'." };
+
+			return makeProgram(context, outputs);
+		}
+
+		// OUTPUT <- '[' EXPRESSION ( ',' EXPRESSION )* ']' / EXPRESSION
+		vector<shared_ptr<Expression>> parseOutput() {
+			skipWhitespace();
+			if (peek() != '[')
+				return { parseExpression(1) };
+			pos++;
+
+			vector<shared_ptr<Expression>> outputs;
+			while (true) {
+				outputs.push_back(parseExpression(1));
+				skipWhitespace();
+				if (peek() == ',') {
+					pos++;
+					continue;
+				}
+				if (peek() == ']') {
+					pos++;
+					return outputs;
+				}
+				throw SyntaxError{ pos, "Expected ',' or ']'." };
+			}
+		}
+
+	private:
+		const string& text;
+		ParseContext& context;
+		size_t pos = 0;
+
+		char peek(size_t offset = 0) const {
+			return pos + offset < text.size() ? text[pos + offset] : '\0';
+		}
+
+		// %whitespace: 空白、行注释、块注释
+		void skipWhitespace() {
+			while (pos < text.size()) {
+				char c = text[pos];
+				if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+					pos++;
+				else if (c == '/' && peek(1) == '/') {
+					while (pos < text.size() && text[pos] != '\n' && text[pos] != '\r')
+						pos++;
+				}
+				else if (c == '/' && peek(1) == '*') {
+					size_t end = text.find("*/", pos + 2);
+					if (end == string::npos)
+						throw SyntaxError{ pos, "Unterminated comment." };
+					pos = end + 2;
+				}
+				else
+					break;
+			}
+		}
+
+		string readIdentifier() {
+			size_t start = pos;
+			while (pos < text.size() && isIdentifierChar(text[pos]))
+				pos++;
+			return text.substr(start, pos - start);
+		}
+
+		// STATEMENT <- ( STATEDECL / LETBINDING / ASSIGNMENT ) ';'
+		// 不是语句时恢复位置并返回 false
+		bool parseStatement() {
+			size_t start = pos;
+			if (!isIdentifierStart(peek()))
+				return false;
+
+			StatementKind kind = StatementKind::ASSIGN;
+			string name = readIdentifier();
+
+			if (name == "state" || name == "let") {
+				size_t keyword_end = pos;
+				skipWhitespace();
+				if (isIdentifierStart(peek())) {
+					kind = name == "state" ? StatementKind::STATE : StatementKind::LET;
+					name = readIdentifier();
+				}
+				else
+					pos = keyword_end;		// 关键字本身被用作名字，如 "let = 1;"
+			}
+
+			skipWhitespace();
+			if (peek() != '=') {
+				pos = start;
+				return false;
+			}
+			pos++;
+
+			shared_ptr<Expression> expr = parseExpression(1);
+
+			skipWhitespace();
+			if (peek() != ';')
+				throw SyntaxError{ pos, "Expected ';'." };
+			pos++;
+			skipWhitespace();
+
+			Statement statement;
+			string msg;
+			if (!makeStatement(context, kind, name, expr, statement, msg))
+				throw SyntaxError{ start, msg };
+
+			// 只有完整的语句才会被登记，之后的变量才能引用它
+			registerStatement(context, statement);
+			return true;
+		}
+
+		bool peekOperator(OperatorInfo& info) const {
+			switch (peek()) {
+			case '^': info = { Operation::XOR, 1, 1 }; return true;
+			case '&': info = { Operation::AND, 2, 1 }; return true;
+			case '|': info = { Operation::OR, 2, 1 }; return true;
+			case '+': info = { Operation::ADD, 3, 1 }; return true;
+			case '-': info = { Operation::SUBTRACT, 3, 1 }; return true;
+			case '*': info = { Operation::MULTIPLY, 4, 1 }; return true;
+			case '/': info = { Operation::DIVIDE, 4, 1 }; return true;
+			case '%': info = { Operation::MOD, 4, 1 }; return true;
+			case '<':
+				if (peek(1) != '<') return false;
+				info = { Operation::SHIFT_LEFT, 5, 2 }; return true;
+			case '>':
+				if (peek(1) != '>') return false;
+				info = { Operation::SHIFT_RIGHT, 5, 2 }; return true;
+			default: return false;
+			}
+		}
+
+		// EXPRESSION <- ATOM (OPERATOR ATOM)*，按优先级爬升
+		shared_ptr<Expression> parseExpression(int min_precedence) {
+			shared_ptr<Expression> lhs = parseAtom();
+
+			while (true) {
+				skipWhitespace();
+
+				OperatorInfo info;
+				if (!peekOperator(info) || info.precedence < min_precedence)
+					break;
+				size_t operator_pos = pos;
+				pos += info.length;
+
+				shared_ptr<Expression> rhs = parseExpression(info.precedence + 1);
+				shared_ptr<Expression> result = makeOperation(info.operation, lhs, rhs, context.float_mode, context.simplify);
+				if (result != lhs && result != rhs)		// 化简返回了操作数本身时保留其位置
+					setPosition(*result, operator_pos);
+				lhs = result;
+			}
+			return lhs;
+		}
+
+		// ATOM <- NUMBER / FUNCCALL / VAR / '(' EXPRESSION ')'
+		shared_ptr<Expression> parseAtom() {
+			skipWhitespace();
+			char c = peek();
+
+			if (isDigit(c) || (c == '-' && isDigit(peek(1))))
+				return parseNumber();
+
+			if (c == '(') {
+				pos++;
+				shared_ptr<Expression> expr = parseExpression(1);
+				skipWhitespace();
+				if (peek() != ')')
+					throw SyntaxError{ pos, "Expected ')'." };
+				pos++;
+				return expr;
+			}
+
+			if (isIdentifierStart(c)) {
+				size_t name_pos = pos;
+				string name = readIdentifier();
+				size_t name_end = pos;
+
+				skipWhitespace();
+				if (peek() == '(')
+					return parseFunctionCall(name, name_pos);
+				pos = name_end;
+
+				shared_ptr<Expression> variable = resolveVariable(context, name);
+				if (variable == nullptr)
+					throw SyntaxError{ name_pos, "Unknown variable " + name + "." };
+				return variable;
+			}
+
+			if (pos >= text.size())
+				throw SyntaxError{ pos, "Unexpected end of input." };
+			throw SyntaxError{ pos, "Unexpected '" + string(1, c) + "'." };
+		}
+
+		// NUMBER <- < '-'? [0-9]+ ('.' [0-9]+)? >
+		shared_ptr<Expression> parseNumber() {
+			size_t start = pos;
+			if (peek() == '-')
+				pos++;
+			while (isDigit(peek()))
+				pos++;
+			if (peek() == '.' && isDigit(peek(1))) {
+				pos++;
+				while (isDigit(peek()))
+					pos++;
+			}
+
+			string msg;
+			shared_ptr<Constant> number = makeNumber(text.substr(start, pos - start), context.float_mode, msg);
+			if (number == nullptr)
+				throw SyntaxError{ start, msg };
+			return number;
+		}
+
+		// FUNCCALL <- FUNCNAME '(' ( EXPRESSION ( ',' EXPRESSION )* )? ')'
+		shared_ptr<Expression> parseFunctionCall(const string& name, size_t name_pos) {
+			if (FormulaParser::function_dictionary.count(name) == 0)
+				throw SyntaxError{ name_pos, "Unknown function " + name + "." };
+			pos++;		// '('
+
+			vector<shared_ptr<Expression>> args;
+			skipWhitespace();
+			if (peek() == ')')
+				pos++;
+			else {
+				while (true) {
+					args.push_back(parseExpression(1));
+					skipWhitespace();
+					if (peek() == ',') {
+						pos++;
+						continue;
+					}
+					if (peek() == ')') {
+						pos++;
+						break;
+					}
+					throw SyntaxError{ pos, "Expected ',' or ')'." };
+				}
+			}
+
+			string msg;
+			if (!checkFunctionArity(name, args.size(), msg) || !checkFunctionMode(name, context.float_mode, msg))
+				throw SyntaxError{ name_pos, msg };
+
+			shared_ptr<Expression> result = makeFunctionCall(name, args, context.float_mode, context.simplify);
+			setPosition(*result, name_pos);
+			return result;
+		}
+
+		// 节点的源码位置，与 peglib 的 line_info 一致
+		void setPosition(Expression& expr, size_t offset) const {
+			size_t line, col;
+			lineColumn(text, offset, line, col);
+			expr.setPosition(line, col);
+		}
+	};
+}
+
+
+ParseResult PrattParser::parse(const string& input, bool float_mode, bool simplify) noexcept {
+	ParseContext context;
+	context.float_mode = float_mode;
+	context.simplify = simplify;
+
+	try {
+		Parser parser(input, context);
+		shared_ptr<Program> program = parser.parseInput();
+		return { true, program->expr, program, 0, 0, "", "" };
+	}
+	catch (const SyntaxError& e) {							// 语法错误
+		size_t line, col;
+		lineColumn(input, e.pos, line, col);
+		return { false, nullptr, nullptr, line, col, e.msg, "" };
+	}
+	catch (const std::exception& e) {						// 标准异常
+		return { false, nullptr, nullptr, 0, 0, e.what(), "" };
+	}
+	catch (...) {											// 未知的潜在异常
+		return { false, nullptr, nullptr, 0, 0, "Unknown Exception", "" };
+	}
+}
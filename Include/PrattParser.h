@@ -0,0 +1,17 @@
+#ifndef PRATT_PARSER_H
+#define PRATT_PARSER_H
+
+#include <string>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 手写的递归下降 / 优先级爬升解析器
+	// 接受与 FormulaParser::grammar 相同的语法 (运算符优先级、注释、语句、函数参数量检查)，
+	// 直接构造 IR 而不经过 std::any，也不需要在运行时编译语法
+	class PrattParser {
+	public:
+		static ParseResult parse(const std::string& input, bool float_mode = false, bool simplify = true) noexcept;	// float_mode: 源码的 #float 指令已由 FormulaParser 去除
+	};
+};
+#endif
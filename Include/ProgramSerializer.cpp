@@ -0,0 +1,227 @@
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "FloatMath.h"
+#include "FormulaCache.h"
+#include "ProgramSerializer.h"
+
+using namespace fparse;
+using namespace std;
+
+namespace {
+	enum NodeTag : uint8_t {
+		CONSTANT = 0,
+		VARIABLE = 1,
+		COMPOUND = 2,
+		FUNCTION = 3
+	};
+
+	constexpr char magic[4] = { 'B', 'A', 'P', 'G' };
+	constexpr int max_depth = 1024;					// 防止损坏的数据导致过深的递归
+
+	// 小端序写入
+	class Writer {
+	public:
+		string data;
+
+		void u8(uint8_t value) { data.push_back(static_cast<char>(value)); }
+		void u16(uint16_t value) { for (int i = 0; i < 2; i++) u8(static_cast<uint8_t>(value >> (8 * i))); }
+		void u32(uint32_t value) { for (int i = 0; i < 4; i++) u8(static_cast<uint8_t>(value >> (8 * i))); }
+		void u64(uint64_t value) { for (int i = 0; i < 8; i++) u8(static_cast<uint8_t>(value >> (8 * i))); }
+		void str(const string& value) { u16(static_cast<uint16_t>(value.size())); data += value; }
+
+		void expression(const Expression& expr) {
+			if (auto constant = dynamic_cast<const Constant*>(&expr)) {
+				u8(CONSTANT);
+				u32(static_cast<uint32_t>(constant->value));
+				u32(fastmath::toBits(constant->float_value));
+			}
+			else if (auto variable = dynamic_cast<const Variable*>(&expr)) {
+				u8(VARIABLE);
+				str(variable->name);
+			}
+			else if (auto compound = dynamic_cast<const CompoundExpression*>(&expr)) {
+				u8(COMPOUND);
+				u8(static_cast<uint8_t>(compound->operation));
+				expression(*compound->l);
+				expression(*compound->r);
+			}
+			else if (auto function = dynamic_cast<const FunctionExpression*>(&expr)) {
+				u8(FUNCTION);
+				str(function->name);
+				u8(static_cast<uint8_t>(function->args.size()));
+				for (const auto& arg : function->args)
+					expression(*arg);
+			}
+			else
+				throw invalid_argument("Unknown expression type");
+
+			u32(static_cast<uint32_t>(expr.line));
+			u32(static_cast<uint32_t>(expr.col));
+		}
+	};
+
+	// 读取越界或内容非法时抛出异常
+	class Reader {
+	public:
+		unordered_set<string> names;				// 可引用的变量: 内置变量与已读到的语句
+		bool float_mode = false;
+
+		explicit Reader(const string& input) : data(input) {
+			for (const auto& entry : FormulaParser::variable_ranges)
+				names.insert(entry.first);
+		}
+
+		uint8_t u8() {
+			if (pos >= data.size())
+				throw out_of_range("Truncated program data");
+			return static_cast<uint8_t>(data[pos++]);
+		}
+		uint16_t u16() { uint16_t value = 0; for (int i = 0; i < 2; i++) value |= static_cast<uint16_t>(u8()) << (8 * i); return value; }
+		uint32_t u32() { uint32_t value = 0; for (int i = 0; i < 4; i++) value |= static_cast<uint32_t>(u8()) << (8 * i); return value; }
+		uint64_t u64() { uint64_t value = 0; for (int i = 0; i < 8; i++) value |= static_cast<uint64_t>(u8()) << (8 * i); return value; }
+		string str() {
+			size_t size = u16();
+			if (data.size() - pos < size)
+				throw out_of_range("Truncated program data");
+			string value = data.substr(pos, size);
+			pos += size;
+			return value;
+		}
+
+		bool atEnd() const { return pos == data.size(); }
+
+		shared_ptr<Expression> expression(int depth = 0) {
+			if (depth > max_depth)
+				throw invalid_argument("Program data too deep");
+
+			shared_ptr<Expression> expr;
+			switch (u8()) {
+			case CONSTANT: {
+				int32_t value = static_cast<int32_t>(u32());
+				float float_value = fastmath::fromBits(u32());
+				expr = make_shared<Constant>(value, float_value);
+				break;
+			}
+			case VARIABLE: {
+				string name = str();
+				if (names.count(name) == 0)			// 否则求值时才会在 vars 中找不到
+					throw invalid_argument("Unknown variable");
+				expr = make_shared<Variable>(name);
+				break;
+			}
+			case COMPOUND: {
+				uint8_t operation = u8();
+				if (operation < static_cast<uint8_t>(Operation::ADD) || operation > static_cast<uint8_t>(Operation::SHIFT_RIGHT))
+					throw invalid_argument("Invalid operation");
+				auto lhs = expression(depth + 1);
+				auto rhs = expression(depth + 1);
+				expr = make_shared<CompoundExpression>(static_cast<Operation>(operation), lhs, rhs);	// 直接构造，不重新化简
+				break;
+			}
+			case FUNCTION: {
+				string name = str();
+				size_t count = u8();
+				string msg;
+				if (FormulaParser::function_dictionary.count(name) == 0 || !checkFunctionArity(name, count, msg) || !checkFunctionMode(name, float_mode, msg))
+					throw invalid_argument("Invalid function call");
+				vector<shared_ptr<Expression>> args;
+				for (size_t i = 0; i < count; i++)
+					args.push_back(expression(depth + 1));
+				expr = make_shared<FunctionExpression>(name, args);
+				break;
+			}
+			default:
+				throw invalid_argument("Invalid node type");
+			}
+
+			size_t line = u32();
+			size_t col = u32();
+			expr->setPosition(line, col);
+			return expr;
+		}
+
+	private:
+		const string& data;
+		size_t pos = 0;
+	};
+}
+
+
+uint64_t fparse::formulaHash(const string& source) {
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : normalizeFormula(source)) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+string fparse::serializeProgram(const Program& program, const string& source) {
+	Writer writer;
+	writer.data.append(magic, sizeof(magic));
+	writer.u16(program_format_version);
+	writer.u64(formulaHash(source));
+	writer.u8(program.float_mode ? 1 : 0);
+
+	writer.u16(static_cast<uint16_t>(program.statements.size()));
+	for (const Statement& statement : program.statements) {
+		writer.u8(static_cast<uint8_t>(statement.kind));
+		writer.str(statement.name);
+		writer.expression(*statement.expr);
+	}
+	writer.u16(static_cast<uint16_t>(program.outputs.size()));
+	for (const shared_ptr<Expression>& output : program.outputs)
+		writer.expression(*output);
+	return writer.data;
+}
+
+shared_ptr<Program> fparse::deserializeProgram(const string& data, const string& source) noexcept {
+	try {
+		if (data.size() < sizeof(magic) || memcmp(data.data(), magic, sizeof(magic)) != 0)
+			return nullptr;
+
+		Reader reader(data);
+		for (size_t i = 0; i < sizeof(magic); i++)
+			reader.u8();
+		if (reader.u16() != program_format_version)
+			return nullptr;
+		if (reader.u64() != formulaHash(source))			// 保存后源码被修改 (或数据属于其他公式)
+			return nullptr;
+		uint8_t flags = reader.u8();
+		if (flags > 1)
+			return nullptr;
+		reader.float_mode = flags == 1;
+
+		vector<Statement> statements(reader.u16());
+		for (Statement& statement : statements) {
+			uint8_t kind = reader.u8();
+			if (kind > static_cast<uint8_t>(StatementKind::ASSIGN))
+				return nullptr;
+			statement.kind = static_cast<StatementKind>(kind);
+			statement.name = reader.str();
+			statement.expr = reader.expression();
+			if (statement.kind != StatementKind::ASSIGN)
+				reader.names.insert(statement.name);		// 只有之后的语句能引用它
+			if (statement.kind == StatementKind::STATE && (reader.float_mode || !statement.expr->isConstant()))
+				return nullptr;
+		}
+		vector<shared_ptr<Expression>> outputs(reader.u16());
+		if (outputs.empty())
+			return nullptr;
+		for (shared_ptr<Expression>& output : outputs)
+			output = reader.expression();
+		if (!reader.atEnd())
+			return nullptr;
+
+		return make_shared<Program>(statements, outputs, reader.float_mode);	// 值域分析与 lane 选择在构造时完成
+	}
+	catch (...) {
+		return nullptr;
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef PROGRAM_SERIALIZER_H
+#define PROGRAM_SERIALIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "FormulaParser.h"
+
+namespace fparse {
+	// 已解析 (并化简) 的 Program 的二进制格式，用于随工程保存，加载时不必重新解析
+	// 格式: "BAPG" | 格式版本 (u16) | 源码哈希 (u64) | 模式 (u8，1 为浮点模式) | 语句数 (u16) | 语句... | 输出数 (u16) | 输出表达式...
+	// 节点按前序写出: 类型 (u8) 之后为常数值 (int32 与 float 的位) / 变量名 / 运算符与两个子节点 / 函数名、参数个数与参数，以及源码位置
+	// 求值语义或 IR 改变时必须增加 program_format_version，旧的数据随即失效并回退到重新解析
+	constexpr uint16_t program_format_version = 4;
+
+	uint64_t formulaHash(const std::string& source);										// 规范文本的 FNV-1a 哈希，与空白和注释无关
+
+	std::string serializeProgram(const Program& program, const std::string& source);
+
+	// 版本不符、哈希与 source 不符或数据损坏时返回 nullptr (此时应重新解析 source)
+	std::shared_ptr<Program> deserializeProgram(const std::string& data, const std::string& source) noexcept;
+};
+#endif
@@ -0,0 +1,46 @@
+#ifndef TRANSPORT_POSITION_H
+#define TRANSPORT_POSITION_H
+
+#include <cmath>
+#include <cstdint>
+
+namespace fparse {
+	// 宿主的播放位置 (插件的 processBlock 从 playhead 取得): 播放中且给出 PPQ 时 T 与 lfo 由此计算，重复渲染的结果相同且与小节对齐
+	// 位置与速度在 block 起点取得 (JUCE 的 playhead 不提供 block 内的速度变化)，block 内按该速度线性推进，越过循环终点处回到起点
+	// 不依赖 JUCE，供插件与 FormulaCLI verify-transport 共用
+	struct TransportPosition {
+		bool synced = false;														// 宿主在播放且给出了 PPQ 与 bpm
+		double ppq = 0.;															// block 起点的位置 (拍)
+		double ppq_per_sample = 0.;													// 每个渲染的 sample (过采样后) 推进的拍数
+		bool looping = false;
+		double loop_start = 0.;
+		double loop_end = 0.;
+
+		// 由宿主 block 的长度 (host_samples 个宿主 sample) 及其渲染的 sample 数 (过采样后) 计算步长
+		// 只用 block 实际覆盖的拍数，与过采样的倍数无关: 下一个 block 恰好从本 block 的终点开始
+		inline void setSpan(double bpm, double host_rate, int host_samples, int rendered_samples) {
+			ppq_per_sample = rendered_samples > 0 ? bpm / 60. * (host_samples / host_rate) / rendered_samples : 0.;
+		}
+
+		// block 中第 sample 个渲染的 sample 的位置
+		inline double ppqAt(int sample) const {
+			double position = ppq + sample * ppq_per_sample;
+			if (looping && position >= loop_end)
+				position = loop_start + std::fmod(position - loop_start, loop_end - loop_start);
+			return position;
+		}
+
+		// 宿主 block 中第 host_sample 个 sample 上的 MIDI 事件在渲染的 block (过采样 ratio 倍，共 rendered_samples 个 sample) 中的位置
+		// 两条渲染路径 (合并求值与含状态变量的逐事件切分) 共用，事件与 T 落在同一时刻
+		static inline int eventPosition(int host_sample, int ratio, int rendered_samples) {
+			int position = host_sample * ratio;
+			return position < 0 ? 0 : (position >= rendered_samples ? rendered_samples - 1 : position);
+		}
+
+		// 位置对应的 T (每拍 256)，超出 int32 时按 two's complement 回绕
+		static inline int32_t standardTime(double position) {
+			return static_cast<int32_t>(static_cast<uint32_t>(static_cast<int64_t>(position * 256.)));
+		}
+	};
+};
+#endif
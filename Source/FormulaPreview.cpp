@@ -0,0 +1,167 @@
+#include "FormulaPreview.h"
+#include <cmath>
+
+//==============================================================================
+FormulaPreview::FormulaPreview() : juce::Thread("FormulaPreview")
+{
+    setOpaque(true);
+    startThread(juce::Thread::Priority::low);
+}
+
+FormulaPreview::~FormulaPreview()
+{
+    generation++;
+    cancelPendingUpdate();
+    stopThread(2000);
+}
+
+void FormulaPreview::render(std::shared_ptr<fparse::Program> program, const std::array<int, 4>& macros, int output_bits, double emulation_rate)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        job = { program, macros, output_bits, emulation_rate };
+        job_pending = program != nullptr;
+        columns.clear();
+        rendered_columns = 0;
+    }
+    display.clear();
+    display_columns = 0;
+    repaint();
+
+    if (program != nullptr)
+        notify();
+}
+
+void FormulaPreview::run()
+{
+    while (!threadShouldExit()) {
+        Job current;
+        uint64_t job_generation = 0;
+        bool has_job = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job_pending) {
+                current = job;
+                job_generation = generation.load();
+                job_pending = false;
+                has_job = true;
+            }
+        }
+
+        if (!has_job) {
+            wait(-1);
+            continue;
+        }
+
+        try {
+            renderJob(current, job_generation);
+        }
+        catch (...) {                                           // ֵʱʾ
+        }
+    }
+}
+
+void FormulaPreview::renderJob(const Job& current, uint64_t job_generation)
+{
+    // е voice ͬ: w x y z Ϊbpm δ֪ (ʹĬֵ)
+    // λϳģʽ̶ģ _8BitSynthesiser::prepareRender һ
+    std::shared_ptr<fparse::Program> program = current.program;
+    double bpm = -1.;
+    RenderContext context;
+    context.output_bits = juce::jlimit(1, 16, current.output_bits);
+    context.full_scale = 128.f / 510.f;
+    context.hold.prepare(block_size);
+    context.hold.setRates(sample_rate, current.emulation_rate);
+    const char* macro_names[4] = { "w", "x", "y", "z" };
+    for (int m = 0; m < 4; m++)
+        context.macros[macro_names[m]] = fparse::EvaluationResult({ current.macros[m] });
+    for (const std::string& name : program->variables) {           // ĵԴȡ: lfo е㣬CC Ϊ 0
+        bool lfo = name.compare(0, 3, "lfo") == 0;
+        if (lfo || name.compare(0, 2, "cc") == 0)
+            context.modulation[name] = fparse::EvaluationResult({ lfo ? 128 : 0 });
+    }
+
+    _8BitSynthVoice voice(program, context, bpm);
+    voice.setCurrentPlaybackSampleRate(sample_rate);
+    voice.prepare(block_size, 1);
+    voice.startNote(preview_note, 1.f, nullptr, 8192);         // е
+
+    const int total_samples = juce::roundToInt(sample_rate * duration_seconds);
+    const int samples_per_column = (total_samples + thumbnail_columns - 1) / thumbnail_columns;
+    const int publish_interval = thumbnail_columns / publish_steps;
+
+    juce::AudioBuffer<float> buffer(1, block_size);
+    std::vector<Column> result(thumbnail_columns, { 0.f, 0.f });
+    int column = 0, in_column = 0, published = 0;
+    float lo = 0.f, hi = 0.f;
+
+    for (int start = 0; start < total_samples; start += block_size) {
+        if (threadShouldExit() || generation.load() != job_generation)     // µ
+            return;
+
+        int numSamples = juce::jmin(block_size, total_samples - start);
+        buffer.clear();
+        context.hold.plan(numSamples);
+        voice.renderNextBlock(buffer, 0, numSamples);
+
+        const float* samples = buffer.getReadPointer(0);
+        for (int i = 0; i < numSamples; i++) {
+            lo = in_column == 0 ? samples[i] : juce::jmin(lo, samples[i]);
+            hi = in_column == 0 ? samples[i] : juce::jmax(hi, samples[i]);
+            if (++in_column == samples_per_column && column < thumbnail_columns) {
+                result[column++] = { lo, hi };
+                in_column = 0;
+            }
+        }
+
+        if (column - published >= publish_interval) {
+            publish(result, column, job_generation);
+            published = column;
+        }
+    }
+
+    if (in_column > 0 && column < thumbnail_columns)
+        result[column++] = { lo, hi };
+    publish(result, column, job_generation);
+}
+
+void FormulaPreview::publish(const std::vector<Column>& result, int count, uint64_t job_generation)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation.load() != job_generation)
+        return;
+    columns = result;
+    rendered_columns = count;
+    triggerAsyncUpdate();
+}
+
+void FormulaPreview::handleAsyncUpdate()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        display = columns;
+        display_columns = rendered_columns;
+    }
+    repaint();
+}
+
+void FormulaPreview::paint(juce::Graphics& g)
+{
+    g.fillAll(juce::Colours::black);
+
+    auto bounds = getLocalBounds().toFloat().reduced(1.f);
+    g.setColour(juce::Colours::darkgrey);
+    g.drawHorizontalLine(juce::roundToInt(bounds.getCentreY()), bounds.getX(), bounds.getRight());
+
+    // voice Ϊ (uint8 - 128) / 510ԼΪ 0.25
+    const float full_scale = 128.f / 510.f;
+    const float column_width = bounds.getWidth() / thumbnail_columns;
+
+    g.setColour(juce::Colour(98, 228, 117));
+    for (int c = 0; c < display_columns; c++) {
+        float top = bounds.getCentreY() - juce::jlimit(-1.f, 1.f, display[c].second / full_scale) * bounds.getHeight() * 0.5f;
+        float bottom = bounds.getCentreY() - juce::jlimit(-1.f, 1.f, display[c].first / full_scale) * bounds.getHeight() * 0.5f;
+        g.fillRect(bounds.getX() + c * column_width, top, juce::jmax(1.f, column_width), juce::jmax(1.f, bottom - top));
+    }
+}
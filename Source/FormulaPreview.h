@@ -0,0 +1,60 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+//==============================================================================
+// ʽԤ
+// ں̨߳ _8BitSynthVoice Ⱦһǰ duration_seconds  ( audio thread ֵͬ·)ʾΪͼ
+// ʹų́õѱ program½; Ⱦзֶηͼ𲽸
+// µ render ʹеȾһ block 
+class FormulaPreview : public juce::Component, private juce::Thread, private juce::AsyncUpdater {
+public:
+    static constexpr double sample_rate = 48000.;
+    static constexpr double duration_seconds = 2.;
+    static constexpr int preview_note = 60;                    // C4
+    static constexpr int block_size = 512;
+    static constexpr int thumbnail_columns = 400;
+    static constexpr int publish_steps = 8;                    // һȾзֽĴ
+
+    FormulaPreview();
+    ~FormulaPreview() override;
+
+    // message threadprogram Ϊ nullptr ʱ; λģĲ (0 Ϊģ) Ĳͬ
+    void render(std::shared_ptr<fparse::Program> program, const std::array<int, 4>& macros, int output_bits, double emulation_rate);
+    void paint(juce::Graphics& g) override;
+
+private:
+    struct Job {
+        std::shared_ptr<fparse::Program> program;
+        std::array<int, 4> macros{};
+        int output_bits = 8;
+        double emulation_rate = 0.;
+    };
+    using Column = std::pair<float, float>;                    // һеСֵֵ
+
+    std::atomic<uint64_t> generation{ 0 };                     // ÿһȾ߳̾ݴ˷ڵ
+
+    std::mutex mutex;                                          // 뷢Ľ
+    Job job;
+    bool job_pending = false;
+    std::vector<Column> columns;
+    int rendered_columns = 0;
+
+    std::vector<Column> display;                               // message thread ϵĸ
+    int display_columns = 0;
+
+    void run() override;
+    void renderJob(const Job& current, uint64_t job_generation);
+    void publish(const std::vector<Column>& result, int count, uint64_t job_generation);
+    void handleAsyncUpdate() override;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FormulaPreview)
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+//==============================================================================
+// һ block 
+struct BlockMetrics {
+    double time;                    // ʼȾʱʱ (sTime::getMillisecondCounterHiRes)
+    double render_ms;               // processBlock ĺʱ
+    double evaluate_ms;             // йʽֵĺʱ ( voice)
+    double buffer_ms;               // block ӦƵʱ
+    int evaluated_samples;          // ֵ sample  ( voice ֮ͣ)
+    int active_voices;
+
+    inline double getLoad() const {                     // render ʱռ buffer ʱıӽ 1 ʱ xrun ķ
+        return buffer_ms > 0. ? render_ms / buffer_ms : 0.;
+    };
+
+    inline double getVoiceMilliseconds() const {        // ƽÿ voice ֵʱ
+        return active_voices > 0 ? evaluate_ms / active_voices : 0.;
+    };
+
+    inline double getNanosecondsPerSample() const {     // ʽÿ sample ֵ
+        return evaluated_samples > 0 ? evaluate_ms * 1.0e6 / evaluated_samples : 0.;
+    };
+};
+
+
+//==============================================================================
+// ߵߵλ
+// audio thread д룬message thread ; ʱݣд뷽Ӳȴ
+template <typename T, int Capacity>
+class MetricsFifo {
+public:
+    bool push(const T& item) {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        if (size1 == 0)
+            return false;
+        items[start1] = item;
+        fifo.finishedWrite(1);
+        return true;
+    };
+
+    bool pop(T& item) {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(1, start1, size1, start2, size2);
+        if (size1 == 0)
+            return false;
+        item = items[start1];
+        fifo.finishedRead(1);
+        return true;
+    };
+
+private:
+    juce::AbstractFifo fifo{ Capacity };
+    std::array<T, Capacity> items;
+};
+
+
+//==============================================================================
+// ܼ
+// audio thread  processBlock β beginBlock / endBlocksynth ֵǰ addEvaluation
+// ÿ block Ľ MetricsFifo  editorʱʹ Time::getHighResolutionTicks
+class PerformanceMonitor {
+public:
+    static constexpr int fifo_size = 1024;                  // Լ 10 s  block (512 samples, 48 kHz)
+    static constexpr double overload_threshold = 0.7;      // load ֵΪ xrun 
+
+    inline void beginBlock() {                              // audio thread
+        block_start = juce::Time::getHighResolutionTicks();
+        block_time = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        evaluate_ticks = 0;
+        evaluated_samples = 0;
+        active_voices = 0;
+    };
+
+    inline void addEvaluation(int64_t ticks, int samples, int voices) {    // audio threadÿ renderVoices һ
+        evaluate_ticks += ticks;
+        evaluated_samples += samples;
+        active_voices = juce::jmax(active_voices, voices);
+    };
+
+    inline void endBlock(int numSamples, double sampleRate) {              // audio thread
+        BlockMetrics metrics;
+        metrics.time = block_time;
+        metrics.render_ms = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - block_start) * 1000.;
+        metrics.evaluate_ms = juce::Time::highResolutionTicksToSeconds(evaluate_ticks) * 1000.;
+        metrics.buffer_ms = sampleRate > 0. ? numSamples * 1000. / sampleRate : 0.;
+        metrics.evaluated_samples = evaluated_samples;
+        metrics.active_voices = active_voices;
+
+        if (metrics.getLoad() > overload_threshold)
+            overloaded_blocks++;
+        if (!fifo.push(metrics))                            // editor δ򿪻ȡ
+            dropped_blocks++;
+    };
+
+    inline bool popMetrics(BlockMetrics& metrics) {         // message thread
+        return fifo.pop(metrics);
+    };
+
+    std::atomic<uint64_t> overloaded_blocks{ 0 };           //  xrun յ block 
+    std::atomic<uint64_t> dropped_blocks{ 0 };              // 򻺳
+
+private:
+    MetricsFifo<BlockMetrics, fifo_size> fifo;
+
+    int64_t block_start = 0;
+    double block_time = 0.;
+    int64_t evaluate_ticks = 0;
+    int evaluated_samples = 0;
+    int active_voices = 0;
+};
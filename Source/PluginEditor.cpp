@@ -42,7 +42,7 @@ bool FormulaEditor::keyPressed(const juce::KeyPress& key) {
     //  shift + enter ߼
     if (key == juce::KeyPress(juce::KeyPress::returnKey, juce::ModifierKeys::shiftModifier, NULL)) {
 
-        auto result = manager->parse();
+        auto result = manager->parse();         // ̨ѽʱ
 
         if (result.success) {
             // parse ɹʱ߼
@@ -51,9 +51,9 @@ bool FormulaEditor::keyPressed(const juce::KeyPress& key) {
         else {
             // parse ʧʱ߼
             setOutlineColourToRed();
-            // ʾϢ
-            // ...
         }
+        if (onParseResult)                      // ʾϢ
+            onParseResult(result);
         repaint();
         return true;
     }
@@ -62,9 +62,14 @@ bool FormulaEditor::keyPressed(const juce::KeyPress& key) {
     return juce::TextEditor::keyPressed(key);
 };
 
-// ı
+// ı ( onTextChange manager Ľ״̬)
 inline void FormulaEditor::updateText() {
-    juce::TextEditor::setText(manager->getFormula());
+    juce::TextEditor::setText(manager->getFormula(), false);
+    if (manager->isFormulaParsed())
+        setOutlineColourToGreen();
+    else
+        setOutlineColourToYellow();
+    repaint();
 };
 
 // ñ߿ɫ
@@ -89,7 +94,7 @@ inline void FormulaEditor::attachToNewFormulaManager(FormulaManager& m) {
 
 //==============================================================================
 _8BitSynthAudioProcessorEditor::_8BitSynthAudioProcessorEditor(_8BitSynthAudioProcessor& p)
-    : AudioProcessorEditor(&p), audioProcessor(p), formula_editor(p.formula_manager),
+    : AudioProcessorEditor(&p), audioProcessor(p), formula_editor(p.formula_manager), scope_view(p.scope_tap),
     w_attachment(p.apvts, "w", w_slider),
     x_attachment(p.apvts, "x", x_slider),
     y_attachment(p.apvts, "y", y_slider),
@@ -99,13 +104,198 @@ _8BitSynthAudioProcessorEditor::_8BitSynthAudioProcessorEditor(_8BitSynthAudioPr
         addAndMakeVisible(slider);
     addAndMakeVisible(formula_editor);
 
+    error_label.setColour(juce::Label::textColourId, juce::Colour(228, 98, 98));
+    error_label.setFont(juce::FontOptions(14.0f));
+    addAndMakeVisible(error_label);
+
+    // ɹĹʽ (̨ı༭еĹʽύĹʽ) ȾԤ
+    formula_editor.onParseResult = [this](const fparse::ParseResult& result) {
+        showParseResult(result);
+        if (result.success)
+            updatePreview(result.program);
+        };
+    audioProcessor.formula_manager.onBackgroundParsed = [this](const fparse::ParseResult& result) {
+        showParseResult(result);
+        if (result.success)
+            updatePreview(result.program);
+        };
+    audioProcessor.formula_manager.onFormulaRestored = [this](const fparse::ParseResult& result) {     // ˹̻ѡ preset
+        formula_editor.updateText();
+        error_label.setText("", juce::dontSendNotification);
+        if (!result.success || !result.msg.empty())     // 󡢿ܾ
+            showParseResult(result);
+        if (audioProcessor.formula_manager.isFormulaParsed())
+            updatePreview(std::atomic_load(&audioProcessor.formula_manager.getProgram()));
+        };
+    addAndMakeVisible(formula_preview);
+    if (audioProcessor.formula_manager.isFormulaParsed())
+        updatePreview(std::atomic_load(&audioProcessor.formula_manager.getProgram()));
+
+    load_label.setFont(juce::FontOptions(14.0f));
+    load_label.setJustificationType(juce::Justification::centredRight);
+    addAndMakeVisible(load_label);
+
+    export_button.onClick = [this]() { exportMetricsLog(); };
+    addAndMakeVisible(export_button);
+
+    profile_button.onClick = [this]() { showProfileReport(); };
+    addAndMakeVisible(profile_button);
+
+    addAndMakeVisible(scope_view);
+
     setSize (800, 600);
+
+    startTimerHz(metrics_refresh_hz);
 }
 
 
 
 _8BitSynthAudioProcessorEditor::~_8BitSynthAudioProcessorEditor()
 {
+    stopTimer();
+    audioProcessor.formula_manager.onBackgroundParsed = nullptr;
+    audioProcessor.formula_manager.onFormulaRestored = nullptr;
+}
+
+void _8BitSynthAudioProcessorEditor::timerCallback() {
+    // ȡϴˢ blockʾƽֵ
+    double load_sum = 0., peak_load = 0., ns_per_sample = 0., voice_ms = 0.;
+    int count = 0, voices = 0;
+
+    BlockMetrics metrics;
+    while (audioProcessor.performance_monitor.popMetrics(metrics)) {
+        load_sum += metrics.getLoad();
+        peak_load = juce::jmax(peak_load, metrics.getLoad());
+        if (metrics.evaluated_samples > 0) {
+            ns_per_sample = metrics.getNanosecondsPerSample();
+            voice_ms = metrics.getVoiceMilliseconds();
+        }
+        voices = juce::jmax(voices, metrics.active_voices);
+        count++;
+
+        metrics_log.add(metrics);
+    }
+
+    if (metrics_log.size() > max_logged_blocks)
+        metrics_log.removeRange(0, metrics_log.size() - max_logged_blocks);
+
+    if (count == 0)         // δڲ
+        return;
+
+    double average_load = load_sum / count;
+    load_label.setColour(juce::Label::textColourId,
+        peak_load > PerformanceMonitor::overload_threshold ? juce::Colour(228, 98, 98) : juce::Colours::white);
+    load_label.setText(
+        "DSP " + juce::String(average_load * 100., 1) + "% (peak " + juce::String(peak_load * 100., 1) + "%)  "
+        + juce::String(voices) + " voices, " + juce::String(voice_ms, 3) + " ms/voice, " + juce::String(ns_per_sample, 1) + " ns/sample  "
+        + "overloads " + juce::String(audioProcessor.performance_monitor.overloaded_blocks.load()),
+        juce::dontSendNotification);
+}
+
+void _8BitSynthAudioProcessorEditor::showProfileReport() {
+    static constexpr size_t profile_block_size = 512;
+    static constexpr size_t profile_blocks = 50;           // Լʮ
+
+    //  FormulaManager ĺ̨߳ profileɺ message thread ʾ
+    //  FormulaCache:  program дͬͬһʽк source Ӧ
+    std::string source = audioProcessor.formula_manager.getFormula();
+    juce::Component::SafePointer<_8BitSynthAudioProcessorEditor> editor(this);
+    profile_button.setEnabled(false);
+    audioProcessor.formula_manager.runInBackground([editor, source]() {
+        fparse::FormulaParser parser;
+        fparse::ParseResult result = parser.parse(source);
+        std::string report;
+        if (result.success)
+            report = fparse::profileReport(source, fparse::profileProgram(*result.program, profile_block_size, profile_blocks));
+
+        juce::MessageManager::callAsync([editor, result, report]() {
+            if (editor == nullptr)                          // editor ѹر
+                return;
+            editor->profile_button.setEnabled(true);
+            if (result.success)
+                editor->showProfileDialog(report);
+            else
+                editor->showParseResult(result);
+            });
+        });
+}
+
+void _8BitSynthAudioProcessorEditor::showProfileDialog(const std::string& report) {
+    auto* report_view = new juce::TextEditor();
+    report_view->setMultiLine(true, false);
+    report_view->setReadOnly(true);
+    report_view->setScrollbarsShown(true);
+    report_view->setFont(juce::FontOptions(juce::Font::getDefaultMonospacedFontName(), 14.0f, juce::Font::plain));
+    report_view->setText(report);
+    report_view->setSize(720, 480);
+
+    juce::DialogWindow::LaunchOptions options;
+    options.content.setOwned(report_view);
+    options.dialogTitle = "Formula profile";
+    options.componentToCentreAround = this;
+    options.resizable = true;
+    options.useNativeTitleBar = true;
+    options.launchAsync();
+}
+
+void _8BitSynthAudioProcessorEditor::exportMetricsLog() {
+    file_chooser = std::make_unique<juce::FileChooser>("Export performance log",
+        juce::File::getSpecialLocation(juce::File::userDocumentsDirectory).getChildFile("BitAlchemy-performance.csv"), "*.csv");
+
+    // ǵʱļ¼֮ˢӰ
+    auto log = metrics_log;
+    auto formula = audioProcessor.formula_manager.getFormula();
+
+    file_chooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles | juce::FileBrowserComponent::warnAboutOverwriting,
+        [log, formula](const juce::FileChooser& chooser) {
+            auto file = chooser.getResult();
+            if (file == juce::File())
+                return;
+
+            juce::String csv;
+            csv << "# formula: " << juce::String(formula).replace("\n", " ") << "\n";
+            csv << "time_s,render_ms,evaluate_ms,buffer_ms,load,active_voices,evaluated_samples,ms_per_voice,ns_per_sample\n";
+            for (const auto& metrics : log)
+                csv << juce::String(metrics.time, 6) << "," << juce::String(metrics.render_ms, 4) << "," << juce::String(metrics.evaluate_ms, 4) << ","
+                    << juce::String(metrics.buffer_ms, 4) << "," << juce::String(metrics.getLoad(), 4) << "," << metrics.active_voices << ","
+                    << metrics.evaluated_samples << "," << juce::String(metrics.getVoiceMilliseconds(), 4) << "," << juce::String(metrics.getNanosecondsPerSample(), 2) << "\n";
+            file.replaceWithText(csv);
+        });
+}
+
+void _8BitSynthAudioProcessorEditor::updatePreview(std::shared_ptr<fparse::Program> program) {
+    std::array<int, 4> macros;
+    const char* macro_names[4] = { "w", "x", "y", "z" };
+    for (int m = 0; m < 4; m++)
+        macros[m] = static_cast<int>(audioProcessor.apvts.getRawParameterValue(macro_names[m])->load());
+
+    int output_bits = static_cast<int>(audioProcessor.apvts.getRawParameterValue("output_bits")->load());
+    int emulation = static_cast<int>(audioProcessor.apvts.getRawParameterValue("emulation_rate")->load());
+    double emulation_rate = _8BitSynthesiser::emulation_rates[juce::jlimit(0, static_cast<int>(std::size(_8BitSynthesiser::emulation_rates)) - 1, emulation)];
+    formula_preview.render(program, macros, output_bits, emulation_rate);
+}
+
+void _8BitSynthAudioProcessorEditor::showParseResult(const fparse::ParseResult& result) {
+    // ʱ ( _8BitSynthVoice::writeOutput)
+    juce::String warning = result.msg;
+    int channels = audioProcessor.getTotalNumOutputChannels();
+    if (result.success && result.program != nullptr && static_cast<int>(result.program->outputs.size()) > channels)
+        warning << (warning.isEmpty() ? "" : " ") << "The formula has " << static_cast<int>(result.program->outputs.size())
+            << " outputs but only " << channels << " output channels; the extra outputs are discarded.";
+
+    error_label.setColour(juce::Label::textColourId, juce::Colour(228, 98, 98));
+    if (result.success && warning.isNotEmpty()) {    // 桢
+        error_label.setColour(juce::Label::textColourId, juce::Colour(231, 228, 98));
+        error_label.setText(warning, juce::dontSendNotification);
+    }
+    else if (result.success) {
+        error_label.setColour(juce::Label::textColourId, juce::Colours::lightgrey);
+        error_label.setText("Estimated cost " + juce::String(result.cost, 1) + " ns/sample per voice", juce::dontSendNotification);
+    }
+    else if (result.line != 0)
+        error_label.setText("Line " + juce::String(result.line) + ", column " + juce::String(result.col) + ": " + result.msg, juce::dontSendNotification);
+    else
+        error_label.setText(result.msg, juce::dontSendNotification);
 }
 
 //==============================================================================
@@ -142,6 +332,13 @@ void _8BitSynthAudioProcessorEditor::resized()
     auto formula_editor_area = bounds.removeFromTop(bounds.getHeight() * 0.75);
     formula_editor_area.removeFromLeft(border_width);
     formula_editor_area.removeFromRight(border_width);
+    auto status_area = formula_editor_area.removeFromBottom(24);
+    export_button.setBounds(status_area.removeFromRight(90).reduced(2));
+    profile_button.setBounds(status_area.removeFromRight(70).reduced(2));
+    load_label.setBounds(status_area.removeFromRight(status_area.getWidth() / 2));
+    error_label.setBounds(status_area);
+    scope_view.setBounds(formula_editor_area.removeFromRight(formula_editor_area.getWidth() * 0.35).withTrimmedLeft(border_width * 0.5));
+    formula_preview.setBounds(formula_editor_area.removeFromBottom(48).withTrimmedTop(4));
     formula_editor.setBounds(formula_editor_area);
 
     auto rotary_slider_area_width = bounds.getWidth() * 0.25;
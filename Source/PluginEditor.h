@@ -10,6 +10,9 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "FormulaProfiler.h"
+#include "ScopeView.h"
+#include "FormulaPreview.h"
 
 //==============================================================================
 /**
@@ -37,12 +40,14 @@ public:
     inline void setOutlineColourToRed();
     inline void setOutlineColourToYellow();
 
+    std::function<void(const fparse::ParseResult&)> onParseResult;  // ύ (shift + enter) Ļص
+
 private:
     FormulaManager* manager;
 };
 
 
-class _8BitSynthAudioProcessorEditor  : public juce::AudioProcessorEditor
+class _8BitSynthAudioProcessorEditor  : public juce::AudioProcessorEditor, private juce::Timer
 {
 public:
     _8BitSynthAudioProcessorEditor (_8BitSynthAudioProcessor&);
@@ -62,6 +67,17 @@ private:
         z_slider;    // wxyz ť
 
     FormulaEditor formula_editor;                           // 
+    juce::Label error_label;                                // Ϣ
+    juce::Label load_label;                                 // DSP 
+    juce::TextButton export_button{ "Export log" };         // ܼ¼
+    juce::TextButton profile_button{ "Profile" };           // ڵ profile ǰʽ
+    ScopeView scope_view;                                   // ĲƵ
+    FormulaPreview formula_preview;                         // ༭еĹʽԤ
+
+    static constexpr int metrics_refresh_hz = 10;
+    static constexpr int max_logged_blocks = 100000;        //  block ¼ڵ
+    juce::Array<BlockMetrics> metrics_log;
+    std::unique_ptr<juce::FileChooser> file_chooser;
     
     juce::AudioProcessorValueTreeState::SliderAttachment 
         w_attachment, 
@@ -71,6 +87,14 @@ private:
 
     std::vector<RotarySlider*> getRotarySliders();          // ڻȡ 4 ťķ
 
+    void showParseResult(const fparse::ParseResult& result);   // ʾ (̨ύ) 
+    void updatePreview(std::shared_ptr<fparse::Program> program);  // Եǰ w x y z ȾԤ
+
+    void timerCallback() override;                          // ȡݲ¸ʾ
+    void exportMetricsLog();                                //  CSV ¼
+    void showProfileReport();                               // ں̨ profile ǰʽɺʾעԴ
+    void showProfileDialog(const std::string& report);
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (_8BitSynthAudioProcessorEditor)
 };
 
@@ -7,24 +7,33 @@ _8BitSynthAudioProcessor::_8BitSynthAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
      : AudioProcessor (BusesProperties()
                      #if ! JucePlugin_IsMidiEffect
-                      #if ! JucePlugin_IsSynth
-                       .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
-                      #endif
+                       .withInput  ("Input",  juce::AudioChannelSet::stereo(), ! JucePlugin_IsSynth)     // effect ģʽ; ΪϳʱĬϲ
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
                        )
 #endif
 , formula_manager(parser) {
-    std::shared_ptr<fparse::Expression>& expr = formula_manager.getExpr();
-    for (auto i = 0; i < 16; ++i)
-        synth.addVoice(new _8BitSynthVoice(expr, apvts, bpm));
+    std::shared_ptr<fparse::Program>& program = formula_manager.getProgram();
+    for (auto i = 0; i < _8BitSynthesiser::max_voices; ++i)     // ͬʱ polyphony 
+        synth.addVoice(new _8BitSynthVoice(program, synth.getRenderContext(), bpm));
 
     synth.addSound(new _8BitSynthSound());
+
+    formula_manager.checkBudget = [this](fparse::ParseResult& result, bool commit) { return checkFormulaBudget(result, commit); };
+
+    const char* macro_names[4] = { "w", "x", "y", "z" };
+    for (int m = 0; m < 4; m++)
+        macro_parameters[m] = apvts.getParameter(macro_names[m]);
+
+    preset_bank.onSelected = [this](const PresetEntry& preset) {     // ʽı editor  message thread ϸ
+        setPresetMacros(preset);
+        formula_manager.restoreFormula(preset.formula, preset.program);
+        };
 }
 
 _8BitSynthAudioProcessor::~_8BitSynthAudioProcessor()
 {
-
+    formula_manager.cancelBackgroundParsing();          // ̨ʹõ parser  formula_manager 
 }
 
 //==============================================================================
@@ -67,39 +76,53 @@ double _8BitSynthAudioProcessor::getTailLengthSeconds() const
 
 int _8BitSynthAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return juce::jmax(1, preset_bank.size());   // NB: some hosts don't cope very well if you tell them there are 0 programs,
+                                                // so this should be at least 1, even if you're not really implementing programs.
 }
 
 int _8BitSynthAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return preset_bank.getCurrentIndex();
 }
 
+//  audio thread ϵ: ѱ preset ֱӽ programȴ̨
+// macro  (setValueNotifyingHost) 빫ʽı onSelected  message thread ϸ
 void _8BitSynthAudioProcessor::setCurrentProgram (int index)
 {
+    if (const PresetEntry* preset = preset_bank.select(index))
+        std::atomic_store(&formula_manager.getProgram(), preset->program);
 }
 
 const juce::String _8BitSynthAudioProcessor::getProgramName (int index)
 {
-    return {};
+    return preset_bank.getName(index);
 }
 
 void _8BitSynthAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
 }
 
+void _8BitSynthAudioProcessor::setPresetMacros(const PresetEntry& preset)
+{
+    for (int m = 0; m < 4; m++)
+        if (preset.macros[m] >= 0 && macro_parameters[m] != nullptr)
+            macro_parameters[m]->setValueNotifyingHost(macro_parameters[m]->convertTo0to1(static_cast<float>(preset.macros[m])));
+}
+
 //==============================================================================
 void _8BitSynthAudioProcessor::prepareToPlay (double currentSampleRate, int currentSamplesPerBlock)
 {
     uint8_t oversampling_factor = apvts.getRawParameterValue("oversampling_factor")->load();
 
-    synth.setCurrentPlaybackSampleRate(currentSampleRate * oversampling_factor);
+    synth.setCurrentPlaybackSampleRate(currentSampleRate * getOversamplingRatio(oversampling_factor));      // Oversampling  factor Ϊ
+    synth.prepareBuffers(currentSamplesPerBlock * getOversamplingRatio(oversampling_factor), 2);     // Ⱦ osBuffer Ϊ
 
     constexpr auto filterType = juce::dsp::Oversampling<float>::filterHalfBandPolyphaseIIR;
 
     oversampler = std::make_unique<juce::dsp::Oversampling<float>>(2, oversampling_factor, filterType);
     oversampler->initProcessing(currentSamplesPerBlock);
+
+    scope_tap.prepare(currentSampleRate);
 }
 
 void _8BitSynthAudioProcessor::releaseResources()
@@ -127,6 +150,12 @@ bool _8BitSynthAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
         return false;
+   #else
+    //  (effect ģʽ) Բ
+    if (! layouts.getMainInputChannelSet().isDisabled()
+     && layouts.getMainInputChannelSet() != juce::AudioChannelSet::mono()
+     && layouts.getMainInputChannelSet() != juce::AudioChannelSet::stereo())
+        return false;
    #endif
 
     return true;
@@ -136,10 +165,17 @@ bool _8BitSynthAudioProcessor::isBusesLayoutSupported (const BusesLayout& layout
 
 void _8BitSynthAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
-    buffer.clear();
+    performance_monitor.beginBlock();
+
+    // ϳģʽʹ; effect ģʽƵ buffer Уֻû
+    bool effect_mode = apvts.getRawParameterValue("mode")->load() >= 0.5f;
+    int input_channels = effect_mode ? juce::jmin(getTotalNumInputChannels(), buffer.getNumChannels(), 2) : 0;
+    for (auto channel = input_channels; channel < buffer.getNumChannels(); channel++)
+        buffer.clear(channel, 0, buffer.getNumSamples());
 
     // ȡͷ
-    auto position = getPlayHead()->getPosition();
+    auto* play_head = getPlayHead();        //  (Ⱦ) ṩ
+    auto position = play_head != nullptr ? play_head->getPosition() : juce::Optional<juce::AudioPlayHead::PositionInfo>();
 
 
     // ȡ bpm
@@ -153,6 +189,25 @@ void _8BitSynthAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, j
     };
 
 
+    // ȡλ: ʱ T  PPQ 㣬ֹͣʱ note on ۼ
+    fparse::TransportPosition transport;               // ڹ block ĳȼ
+
+    if (position.hasValue() && position->getIsPlaying() && bpm > 0.) {
+        auto ppq = position->getPpqPosition();
+        if (ppq.hasValue()) {
+            transport.synced = true;
+            transport.ppq = *ppq;
+
+            auto loop = position->getLoopPoints();
+            if (position->getIsLooping() && loop.hasValue() && loop->ppqEnd > loop->ppqStart) {
+                transport.looping = true;
+                transport.loop_start = loop->ppqStart;
+                transport.loop_end = loop->ppqEnd;
+            }
+        }
+    }
+
+
     // ˲
     auto currentSampleRate = getSampleRate();
     auto currentSamplesPerBlock = buffer.getNumSamples();
@@ -160,16 +215,93 @@ void _8BitSynthAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, j
     uint8_t oversampling_factor = apvts.getRawParameterValue("oversampling_factor")->load();
 
 
-    // 
+    //  (effect ģʽƵ֮ϲ)
     juce::dsp::AudioBlock<float> block(buffer);
     juce::dsp::AudioBlock<float> osBlock = oversampler->processSamplesUp(block);
     float* p[] = {osBlock.getChannelPointer(0), osBlock.getChannelPointer(1)};
     juce::AudioBuffer<float> osBuffer(p, 2, static_cast<int> (osBlock.getNumSamples()));
-    synth.setCurrentPlaybackSampleRate(currentSampleRate * oversampling_factor);
-    synth.renderNextBlock(osBuffer, midiMessages, 0, osBlock.getNumSamples());
+    synth.setCurrentPlaybackSampleRate(currentSampleRate * getOversamplingRatio(oversampling_factor));
+    transport.setSpan(bpm, currentSampleRate, currentSamplesPerBlock, static_cast<int>(osBlock.getNumSamples()));
+    synth.setTransport(transport);
+    int midi_position_scale = static_cast<int>(osBlock.getNumSamples()) / juce::jmax(1, currentSamplesPerBlock);   // MIDI ¼λðԭʸ
+    if (effect_mode)
+        synth.renderEffect(osBuffer, midiMessages, 0, static_cast<int>(osBlock.getNumSamples()), input_channels);
+    else
+        synth.renderBlock(osBuffer, midiMessages, 0, osBlock.getNumSamples(), midi_position_scale);
     oversampler->processSamplesDown(block);
 
     osBlock.clear();
+
+    scope_tap.push(buffer, currentSamplesPerBlock);
+
+    performance_monitor.endBlock(currentSamplesPerBlock, currentSampleRate);
+}
+
+//==============================================================================
+int _8BitSynthAudioProcessor::getOversamplingRatio(int factor) {
+    return 1 << factor;
+}
+
+bool _8BitSynthAudioProcessor::checkFormulaBudget(fparse::ParseResult& result, bool commit) {
+    double sample_rate = getSampleRate() > 0. ? getSampleRate() : 48000.;
+    int factor = static_cast<int>(apvts.getRawParameterValue("oversampling_factor")->load());
+    int polyphony = static_cast<int>(apvts.getRawParameterValue("polyphony")->load());
+    if (apvts.getRawParameterValue("mode")->load() >= 0.5f)       // effect ģʽֻһֵ
+        polyphony = 1;
+    double budget = apvts.getRawParameterValue("cpu_budget")->load() / 100.;
+    int action = static_cast<int>(apvts.getRawParameterValue("budget_action")->load());
+    int emulation = static_cast<int>(apvts.getRawParameterValue("emulation_rate")->load());
+    double emulation_rate = _8BitSynthesiser::emulation_rates[juce::jlimit(0, static_cast<int>(std::size(_8BitSynthesiser::emulation_rates)) - 1, emulation)];
+
+    //  voice ͬʱʱֵռʵʱı; ģ̶ʱֻڸòֵ
+    auto estimateLoad = [&](int oversampling_factor) {
+        double evaluation_rate = sample_rate * getOversamplingRatio(oversampling_factor);
+        if (emulation_rate > 0. && emulation_rate < evaluation_rate)
+            evaluation_rate = emulation_rate;
+        return result.cost * 1.0e-9 * evaluation_rate * polyphony;
+    };
+
+    double load = estimateLoad(factor);
+    if (load <= budget)
+        return true;
+
+    std::string msg = "Estimated DSP load " + juce::String(load * 100., 0).toStdString() + "% exceeds the "
+        + juce::String(budget * 100., 0).toStdString() + "% budget";
+
+    switch (action) {
+    case 1:     // reject
+        result.msg = msg + (commit ? "; formula rejected." : "; it will be rejected.");
+        return !commit;
+    case 2: {   // reduce oversampling
+        int reduced = factor;
+        while (reduced > 1 && estimateLoad(reduced) > budget && estimateLoad(reduced - 1) < estimateLoad(reduced))     // ģ̶ʱ͹޼
+            reduced--;
+        if (reduced == factor) {
+            result.msg = msg + ".";
+            return true;
+        }
+        if (commit)
+            setOversamplingFactor(reduced);
+        result.msg = msg + (commit ? "; oversampling reduced to " : "; oversampling will be reduced to ") + std::to_string(reduced) + ".";
+        return true;
+    }
+    default:    // warn
+        result.msg = msg + ".";
+        return true;
+    }
+}
+
+void _8BitSynthAudioProcessor::setOversamplingFactor(int factor) {
+    auto* parameter = apvts.getParameter("oversampling_factor");
+    parameter->setValueNotifyingHost(parameter->convertTo0to1(static_cast<float>(factor)));
+
+    if (getSampleRate() <= 0.)      // δ prepareToPlay
+        return;
+
+    // suspendProcessing ʱ processBlock ִУ԰ȫ滻
+    suspendProcessing(true);
+    prepareToPlay(getSampleRate(), getBlockSize());
+    suspendProcessing(false);
 }
 
 //==============================================================================
@@ -184,17 +316,58 @@ juce::AudioProcessorEditor* _8BitSynthAudioProcessor::createEditor()
 }
 
 //==============================================================================
+// ״̬: APVTS ĲӹʽıԤ program
+// <Parameters state_version="1" formula="..." program="0"> <PARAM .../> ... <Program data="base64"/> </Parameters>
 void _8BitSynthAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    juce::ValueTree state = apvts.copyState();
+    std::shared_ptr<fparse::Program> program;
+    std::string formula = formula_manager.getSavedState(program);
+    state.setProperty("state_version", state_version, nullptr);
+    state.setProperty("formula", juce::String(formula), nullptr);
+    state.setProperty("program", preset_bank.getCurrentIndex(), nullptr);
+
+    // ֻıһµ program: ı޸Ķδύջ preset δıʱغ½
+    if (program != nullptr) {
+        std::string data = fparse::serializeProgram(*program, formula);
+        juce::ValueTree compiled("Program");
+        compiled.setProperty("data", juce::Base64::toBase64(data.data(), data.size()), nullptr);
+        state.appendChild(compiled, nullptr);
+    }
+
+    if (std::unique_ptr<juce::XmlElement> xml = state.createXml())
+        copyXmlToBinary(*xml, destData);
 }
 
 void _8BitSynthAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    std::unique_ptr<juce::XmlElement> xml = getXmlFromBinary(data, sizeInBytes);
+    if (xml == nullptr || !xml->hasTagName(apvts.state.getType()))
+        return;
+
+    juce::ValueTree state = juce::ValueTree::fromXml(*xml);
+    if (static_cast<int>(state.getProperty("state_version", 0)) > state_version)     // °汾״̬޷֤ȷȡ
+        return;
+
+    std::string formula = state.getProperty("formula").toString().toStdString();
+    int program = static_cast<int>(state.getProperty("program", 0));
+    std::shared_ptr<fparse::Program> compiled;
+    juce::ValueTree compiled_state = state.getChildWithName("Program");
+    if (compiled_state.isValid()) {
+        juce::MemoryOutputStream stream;
+        if (juce::Base64::convertFromBase64(stream, compiled_state.getProperty("data").toString()))
+            compiled = fparse::deserializeProgram(std::string(static_cast<const char*>(stream.getData()), stream.getDataSize()), formula);
+    }
+
+    // ʽԤݲڲ
+    state.removeProperty("state_version", nullptr);
+    state.removeProperty("formula", nullptr);
+    state.removeProperty("program", nullptr);
+    state.removeChild(compiled_state, nullptr);
+    apvts.replaceState(state);
+
+    formula_manager.restoreFormula(formula, compiled);
+    preset_bank.setCurrentIndex(program);    // ָֻţʽѡ preset ֮󱻱༭
 }
 
 //==============================================================================
@@ -213,7 +386,24 @@ juce::AudioProcessorValueTreeState::ParameterLayout _8BitSynthAudioProcessor::cr
     layout.add(std::make_unique<juce::AudioParameterInt>("y", "y", 0, 255, 0));
     layout.add(std::make_unique<juce::AudioParameterInt>("z", "z", 0, 255, 0));
 
-    layout.add(std::make_unique<juce::AudioParameterInt>("oversampling_factor", "oversampling_factor", 1, 16, 2));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("mode", "mode", juce::StringArray{ "synth", "effect" }, 0));     // effect: ʽƵ (in inL inR)
+
+    layout.add(std::make_unique<juce::AudioParameterInt>("oversampling_factor", "oversampling_factor", 1, max_oversampling_factor, 2));    // : 2^factor 
+    layout.add(std::make_unique<juce::AudioParameterInt>("output_bits", "output_bits", 1, 16, 8));              // ʽλ
+    layout.add(std::make_unique<juce::AudioParameterChoice>("emulation_rate", "emulation_rate",                  // ̶ģ⣬ѡ _8BitSynthesiser::emulation_rates Ӧ
+        juce::StringArray{ "off", "8000 Hz", "11025 Hz", "16000 Hz", "22050 Hz", "32000 Hz", "44100 Hz" }, 0));
+
+    layout.add(std::make_unique<juce::AudioParameterInt>("polyphony", "polyphony", 1, _8BitSynthesiser::max_voices, 16));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("voice_stealing", "voice_stealing", juce::StringArray{ "oldest", "quietest" }, 0));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("release", "release", juce::NormalisableRange<float>(0.f, 2.f, 0.f, 0.5f), 0.f));
+
+    layout.add(std::make_unique<juce::AudioParameterChoice>("lfo1_rate", "lfo1_rate",                            // ÿڵĳȣѡ _8BitSynthesiser::lfo_beats Ӧ
+        juce::StringArray{ "1/16", "1/8", "1/4", "1/2", "1 bar", "2 bars", "4 bars" }, 2));
+    layout.add(std::make_unique<juce::AudioParameterChoice>("lfo2_rate", "lfo2_rate",
+        juce::StringArray{ "1/16", "1/8", "1/4", "1/2", "1 bar", "2 bars", "4 bars" }, 4));
+
+    layout.add(std::make_unique<juce::AudioParameterInt>("cpu_budget", "cpu_budget", 5, 100, 50));     // ʽƸص (%)
+    layout.add(std::make_unique<juce::AudioParameterChoice>("budget_action", "budget_action", juce::StringArray{ "warn", "reject", "reduce oversampling" }, 0));
     
     return layout;
 };
\ No newline at end of file
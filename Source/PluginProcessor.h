@@ -2,52 +2,299 @@
 
 #include <JuceHeader.h>
 #include "FormulaParser.h"
+#include "FormulaCache.h"
+#include "FormulaCost.h"
+#include "ProgramSerializer.h"
+#include "PerformanceMonitor.h"
+#include "PresetBank.h"
+#include "SampleHold.h"
+#include "ScopeTap.h"
+#include "TransportPosition.h"
 #include <xtensor/xarray.hpp>
 #include <xtensor/xview.hpp>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <vector>
 
 
 //==============================================================================
 // ʽ
-class FormulaManager {
+// ༭ʱں̨߳ԤȽ (debounceڵ񱻶)ύ (Shift + Enter) ʱѾֱ滻
+class FormulaManager : private juce::Timer, private juce::AsyncUpdater {
 private:
     fparse::FormulaParser* parser;                          // parser
-    std::string formula;                                    // formula
-    bool parsed;                                            // ǰ formula Ƿѱ parse 
-    std::shared_ptr<fparse::Expression> expr;               // һЧ formula  parse 
+    std::string formula;                                    // formula (pending_mutex)
+    bool parsed;                                            // ǰ formula Ƿѱ parse  (pending_mutex)
+    std::shared_ptr<fparse::Program> program;               // һЧ formula  parse  atomic_store / atomic_load  audio thread
+    std::shared_ptr<fparse::Program> formula_program;       // ǰ formula  parse ;  program ͬʱprogram  setCurrentProgram  preset (pending_mutex)
+
+    std::atomic<uint64_t> generation{ 0 };                  // ÿα༭һʶڵĺ̨
+
+    std::mutex pending_mutex;                               // º̨Լ formula / parsed / formula_program (restoreFormula ܲ message thread )
+    uint64_t pending_generation = 0;
+    bool pending_ready = false;
+    fparse::ParseResult pending_result;
+    std::atomic<bool> restored{ false };                    // restoreFormula ֮δ֪ͨ editor
+    fparse::ParseResult restored_result;                    // restoreFormula Ľ (pending_mutex)
+    bool restored_unchecked = false;                        //  message thread ϻָƳٵ handleAsyncUpdate (pending_mutex)
+
+    inline static std::atomic<bool> calibration_started{ false };  // ÿУ׼һοģ (ʼִʱλ)
+
+    // 뵱ǰʽ޹صĺ̨ (У׼profile)µı༭Ƴ
+    class BackgroundTask : public juce::ThreadPoolJob {
+    public:
+        BackgroundTask(std::function<void()> background_task) : juce::ThreadPoolJob("BackgroundTask"), task(std::move(background_task)) {}
+        JobStatus runJob() override {
+            task();
+            return jobHasFinished;
+        }
+    private:
+        std::function<void()> task;
+    };
+
+    struct ParseJobSelector : juce::ThreadPool::JobSelector {   // ѡ (BackgroundTask )
+        bool isJobSuitable(juce::ThreadPoolJob* job) override {
+            return dynamic_cast<BackgroundTask*>(job) == nullptr;
+        }
+    };
+
+    juce::ThreadPool worker{ 1 };                           // ̨̣߳Ա (ȴ)
+
+    // ŶУ׼; cancelBackgroundParsing Ƴδʼ񣬴ʱ֮ʵŶ
+    inline void queueCalibration() {
+        if (calibration_started.load())
+            return;
+        runInBackground([]() {
+            if (calibration_started.exchange(true))             // ʵִ
+                return;
+            fparse::OperatorCosts::setCurrent(std::make_shared<const fparse::OperatorCosts>(fparse::calibrateOperatorCosts()));
+            });
+    };
+
+    void timerCallback() override {                         // debounce ʼ̨
+        stopTimer();
+
+        uint64_t job_generation = 0;
+        std::string source;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            job_generation = generation.load();
+            source = formula;
+        }
+
+        ParseJobSelector parse_jobs;
+        worker.removeAllJobs(false, 0, &parse_jobs);        // δʼľɽֱƳ
+        worker.addJob([this, job_generation, source]() mutable {
+            if (job_generation != generation.load())       // ʼǰµı༭
+                return;
+
+            fparse::ParseResult result = fparse::FormulaCache::getInstance().parse(*parser, source);   // parser ڶ߳ͬʱʹ
+
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            if (job_generation != generation.load())       // ڼµı༭
+                return;
+            pending_generation = job_generation;
+            pending_ready = true;
+            pending_result = result;
+            triggerAsyncUpdate();
+            });
+    };
+
+    void handleAsyncUpdate() override {                     //  message thread ϱ̨
+        if (restored.exchange(false))
+            reportRestored();
+
+        fparse::ParseResult result;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            if (!pending_ready || pending_generation != generation.load())
+                return;
+            result = pending_result;
+        }
+        if (result.success && checkBudget)                  // ֻעı
+            checkBudget(result, false);
+        if (onBackgroundParsed)
+            onBackgroundParsed(result);
+    };
 
 public:
+    static constexpr int debounce_ms = 250;                             // ֹͣúʼ̨
+
+    std::function<void(const fparse::ParseResult&)> onBackgroundParsed; // ̨ɵĻص (message thread)
+    std::function<void(const fparse::ParseResult&)> onFormulaRestored;  // restoreFormula 滻˹ʽĻص (message thread)result.msg Ϊ
+
+    //  (message thread):  result.cost жǷ񳬳Ԥ㣬޸ result.msg 
+    //  false ʱܾ滻ǰʽ; commit Ϊ false ʱ (̨Ԥ) ֻע msg
+    std::function<bool(fparse::ParseResult&, bool commit)> checkBudget;
+
     FormulaManager(fparse::FormulaParser& formula_parser) {             // 캯
         parser = &formula_parser;
         formula = "";
         parsed = false;
-        expr = nullptr;
+        program = nullptr;
+
+        queueCalibration();
+    };
+
+    ~FormulaManager() override {
+        cancelBackgroundParsing();
+    };
+
+    inline void cancelBackgroundParsing() {                             // ֹͣȴ̨ (parser ǰ)
+        stopTimer();
+        generation++;
+        worker.removeAllJobs(true, 2000);
+        cancelPendingUpdate();
+    };
+
+    // ںִ̨߳뵱ǰʽ޹ص (̵߳)task Ӧ FormulaManager 
+    inline void runInBackground(std::function<void()> task) {
+        worker.addJob(new BackgroundTask(std::move(task)), true);
     };
 
     inline std::string getFormula() {                                   // ȡǰ formula
+        std::lock_guard<std::mutex> lock(pending_mutex);
         return formula;
     };
 
     inline void setFormula(std::string& formula_string) {               // õǰ formula
-        formula = formula_string;
-        parsed = false;                                                 // ǰ formula δ parse
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            formula = formula_string;
+            parsed = false;                                             // ǰ formula δ parse
+            generation++;
+            pending_ready = false;
+        }
+        startTimer(debounce_ms);                                        // ¿ʼʱ
     };
 
     inline fparse::ParseResult parse() {                                // parse ǰ formula
-        fparse::ParseResult result = parser->parse(formula);
+        stopTimer();
+
+        fparse::ParseResult result;
+        bool ready = false;
+        std::string source;
+        uint64_t parse_generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);            // ̨ѽ굱ǰ formula ʱֱʹ
+            if (pending_ready && pending_generation == generation.load()) {
+                result = pending_result;
+                ready = true;
+            }
+            source = formula;
+            parse_generation = generation.load();
+        }
+
+        if (!ready)
+            result = fparse::FormulaCache::getInstance().parse(*parser, source);    // ɽڹĻ
+
+        if (result.success && checkBudget && !checkBudget(result, true))  // Ԥ
+            result.success = false;
+
         if (result.success) {                                           // ִгɹǰ formula ѱ parse parse Ľ
-            parsed = true;
-            expr = result.expr;
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            if (parse_generation == generation.load()) {                // ڼ乫ʽδ restoreFormula 滻
+                parsed = true;
+                formula_program = result.program;
+                std::atomic_store(&program, result.program);
+            }
         }
         return result;
     };
 
+    // ָĹʽ (setStateInformationܲ message thread ; ѡ preset)
+    // compiled Ϊ״̬Ԥ programЧʱٽɻͬ
+    // ύʱͬ (ܽ͹ܾʽ); ֻ message thread ϽУ
+    // ߳ϻָʱ滻 programƳٵ handleAsyncUpdateܾʱƳ
+    inline void restoreFormula(const std::string& source, std::shared_ptr<fparse::Program> compiled) {
+        stopTimer();
+        uint64_t restore_generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            restore_generation = ++generation;                          // еĺ̨
+            pending_ready = false;
+            formula = source;
+            parsed = false;
+        }
+
+        fparse::ParseResult result;
+        if (fparse::FormulaCache::getInstance().lookup(source, result)) {}  // ʵѽͬһʽʱ program
+        else if (compiled != nullptr) {
+            result = { true, compiled->expr, compiled, 0, 0, "", "" };
+            result.cost = fparse::estimateCost(*compiled, *fparse::OperatorCosts::getCurrent());
+            fparse::FormulaCache::getInstance().insert(source, result);
+        }
+        else
+            result = fparse::FormulaCache::getInstance().parse(*parser, source);
+
+        bool on_message_thread = juce::MessageManager::existsAndIsCurrentThread();
+        if (result.success && on_message_thread && checkBudget && !checkBudget(result, true))
+            result.success = false;
+
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            if (restore_generation == generation.load()) {              // ֮ûµı༭ָ
+                parsed = result.success;
+                if (result.success) {
+                    formula_program = result.program;
+                    std::atomic_store(&program, result.program);
+                }
+            }
+            restored_result = result;
+            restored_unchecked = result.success && !on_message_thread;
+        }
+        restored = true;
+        triggerAsyncUpdate();
+    };
+
+    // ƳٵĿ鲢֪ͨ editor (message thread)
+    inline void reportRestored() {
+        fparse::ParseResult result;
+        bool unchecked = false;
+        uint64_t restored_generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            result = restored_result;
+            unchecked = restored_unchecked;
+            restored_unchecked = false;
+            restored_generation = generation.load();
+        }
+        if (unchecked && checkBudget && !checkBudget(result, true)) {
+            result.success = false;
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            if (restored_generation == generation.load()) {             // ֮ûµı༭ָ
+                parsed = false;
+                std::atomic_store(&program, std::shared_ptr<fparse::Program>());
+            }
+        }
+        if (onFormulaRestored)
+            onFormulaRestored(result);
+    };
+
     inline bool isFormulaParsed() {                                     // صǰ formula Ƿѱ parse 
+        std::lock_guard<std::mutex> lock(pending_mutex);
         return parsed;
     };
 
-    inline std::shared_ptr<fparse::Expression>& getExpr() {             // һ expr ָ
-        return expr;
+    // ״̬ĹʽıԼ֮Ӧ program (ûʱΪ nullptr)
+    // setCurrentProgram  audio thread ֱӻ preset  programıҪ onSelected  message thread ϸ;
+    // ڼʹõ program ڵǰıԵǰıĹϣ
+    inline std::string getSavedState(std::shared_ptr<fparse::Program>& saved_program) {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        std::string source = formula;
+        std::shared_ptr<fparse::Program> current = std::atomic_load(&program);
+        saved_program = parsed && current == formula_program ? current : nullptr;
+        return source;
+    };
+
+    inline std::shared_ptr<fparse::Program>& getProgram() {             // һ program ָ
+        return program;
     };
 };
 
@@ -62,21 +309,45 @@ public:
 };
 
 
+//==============================================================================
+// һȾ voice 룬 _8BitSynthesiser ڵ voice ǰд
+// ģ̶ʱ (hold )voice ʱ䡢궼ֵ sample 㣬ֻչĲ
+struct RenderContext {
+    int event_offset = 0;                                                   // ڴ MIDI ¼һȾλ
+    float release_coefficient = 0.f;                                        // release ׶ÿֵ sample İ˥ϵ
+    int output_bits = 8;                                                    // ʽλ (1..16)ҲƵλ
+    float full_scale = 128.f / 510.f;                                       // : ϳģʽΪ 128 / 510effect ģʽΪ 1
+    SampleHold hold;                                                        // ̶ģ⣬Ⱦֵλ
+    fparse::TransportPosition transport;                                    // Ĳλ (block )
+    int render_offset = 0;                                                  // Ⱦ block е ( MIDI ¼зʱΪ 0)
+    std::unordered_map<std::string, fparse::EvaluationResult> macros;       // w x y z  sample ƽֵʱΪԪ
+    std::unordered_map<std::string, fparse::EvaluationResult> modulation;   // Դ (lfo1 lfo2 ccN)ֻ㹫ʽõ
+};
+
+
 //==============================================================================
 // Voice 
+// note on / off Чǰ RenderContext::event_offset ¼һȾдӶӦ sample ʼЧ ( sample )
+// allowTailOff  note off  release: 水ָ˥ silence_level ͷ voice
 class _8BitSynthVoice : public juce::SynthesiserVoice {
 public:
-    _8BitSynthVoice(std::shared_ptr<fparse::Expression>& e, juce::AudioProcessorValueTreeState& s, double& b) 
-        : expr(e), apvts(s), bpm(b){
+    _8BitSynthVoice(std::shared_ptr<fparse::Program>& p, RenderContext& c, double& b) 
+        : program(p), context(c), bpm(b){
         vars["T"] = fparse::EvaluationResult({ 0 });
         vars["t"] = fparse::EvaluationResult({ 0 });
         vars["w"] = fparse::EvaluationResult({ 0 });
         vars["x"] = fparse::EvaluationResult({ 0 });
         vars["y"] = fparse::EvaluationResult({ 0 });
         vars["z"] = fparse::EvaluationResult({ 0 });
+        for (const char* name : input_names)
+            vars[name] = fparse::EvaluationResult({ 0 });
+        pending_events.ensureStorageAllocated(max_pending_events);
     };
 
-    
+    static constexpr int max_pending_events = 32;
+    static constexpr const char* input_names[] = { "in", "inL", "inR" };     // Ƶ (effect ģʽ)ϳģʽΪ
+    static constexpr const char* modulator_names[] = { "env", "vel", "bend" };  // ÿ voice ĵԴ
+    static constexpr float silence_level = 1.0e-4f;            // -80 dB
 
     bool canPlaySound(juce::SynthesiserSound* sound) override
     {
@@ -84,29 +355,35 @@ public:
     }
 
     void startNote(int midiNoteNumber, float velocity,
-        juce::SynthesiserSound*, int /*currentPitchWheelPosition*/) override {
-        frequency = juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber);
-        time = 0.;
-        standard_time = 0.;
+        juce::SynthesiserSound*, int currentPitchWheelPosition) override {
+        note_velocity = juce::roundToInt(velocity * 127.f);
+        bend = currentPitchWheelPosition >> 6;
+        pending_events.add({ context.event_offset, GateEvent::NOTE_ON, juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber) });
+        output_level = std::numeric_limits<float>::max();      // δȾռʱΪ
+
+        auto current_program = std::atomic_load(&program);
+        if (current_program != nullptr)     // ״̬ӳʼֵʼ
+            current_program->resetState(vars);
     }
 
     void stopNote(float /*velocity*/, bool allowTailOff) override
     {
-        //if (allowTailOff)
-        //{
-        //    // ߼
-        //}
-        //else
-        //{
-        //    
-        //}
-        clearCurrentNote();
-        frequency = 0.;
-        time = 0.;
-        standard_time = 0.;
+        if (allowTailOff)
+        {
+            //  release˥Ϻ clearCurrentNote
+            pending_events.add({ context.event_offset, GateEvent::RELEASE, 0. });
+        }
+        else
+        {
+            // ֹͣ (ռ all notes off)
+            clearCurrentNote();
+            pending_events.add({ context.event_offset, GateEvent::NOTE_OFF, 0. });
+        }
     }
 
-    void pitchWheelMoved(int) override {};
+    void pitchWheelMoved(int newPitchWheelValue) override {
+        bend = newPitchWheelValue >> 6;
+    };
     void controllerMoved(int, int) override {};
 
     // ޸ w x y z ֵ
@@ -115,58 +392,711 @@ public:
     };
 
     void renderNextBlock(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override {
-        if (expr == nullptr)    // ʽδ
+        auto current_program = std::atomic_load(&program);      // ʽ message thread ϱ滻
+        if (current_program == nullptr) // ʽδ
             return;
-        if (frequency == 0.)    // δ
+        if (!isSounding())      // δ
             return;
 
-        double sample_rate = getSampleRate();
+        // ֵ sample : ģ̶ʱ context.hold ͬ
+        int count = context.hold.active() ? context.hold.getEvaluatedSamples() : numSamples;
 
-        //  t 
-        double end_time = time + (numSamples - 1) * 256.0 * frequency / sample_rate;
-        double next_time = end_time + 256.0 * frequency / sample_rate;
-        vars["t"] = xt::cast<int32_t>(xt::linspace<double>(time, end_time, numSamples));
-        
-        double block_bpm = bpm;
-        if (block_bpm == -1.) {
-            block_bpm = 150.;     // Ĭbpm
+        //  t, T 
+        vars["t"].resize({ static_cast<size_t>(count) });
+        vars["T"].resize({ static_cast<size_t>(count) });
+        gain.resize(static_cast<size_t>(count));
+        advanceTime(vars["t"].data(), vars["T"].data(), gain.data(), count);
+
+        resizeModulation(*current_program, vars, static_cast<size_t>(count));
+        writeModulation(*current_program, vars, gain.data(), 0, count);
+
+        // ûƵ
+        const int32_t silence = 1 << (context.output_bits - 1);
+        for (const char* name : input_names) {
+            vars[name].resize({ 1 });
+            vars[name][0] = silence;
+        }
+
+        evaluateBlock(*current_program, outputBuffer, startSample, count);
+    }
+
+    // effect ģʽ: ֵbuffer ǰ inputChannels Ƶ滻Ϊʽ
+    // t Ϊֵ sample  (ÿ sample һ)T  bpm ƽΪ 1; ûйʽʱԭͨ
+    void renderEffect(juce::AudioSampleBuffer& buffer, int startSample, int numSamples, int inputChannels) {
+        auto current_program = std::atomic_load(&program);
+        if (current_program == nullptr)
+            return;
+
+        int count = context.hold.active() ? context.hold.getEvaluatedSamples() : numSamples;
+
+        frequency = context.hold.getEvaluationRate() / 256.;   // fillTime  t ĲΪ 1
+        releasing = false;
+        vars["t"].resize({ static_cast<size_t>(count) });
+        vars["T"].resize({ static_cast<size_t>(count) });
+        gain.resize(static_cast<size_t>(count));
+        fillTime(vars["t"].data(), vars["T"].data(), gain.data(), 0, count);
+
+        resizeModulation(*current_program, vars, static_cast<size_t>(count));
+        writeModulation(*current_program, vars, gain.data(), 0, count);
+
+        readInputs(buffer, startSample, count, inputChannels);
+        buffer.clear(startSample, numSamples);
+
+        evaluateBlock(*current_program, buffer, startSample, count);
+    }
+
+    // Ԥȷһ block ( maxBlockSize  sample)  numChannels Ļ (message threadȾʱ)
+    // held_samples ǹʽ: Ҫ
+    void prepare(int maxBlockSize, int numChannels) {
+        const size_t size = static_cast<size_t>(juce::jmax(0, maxBlockSize));
+        gain.reserve(size);
+        output.reserve(size);
+        held.reserve(size);
+        held_samples.assign(static_cast<size_t>(juce::jmax(1, numChannels)), 0.f);
+    }
+
+    //  effect ģʽʱ t = 0 ״̬ĳʼֵʼ
+    void resetEffect() {
+        time = 0.;
+        standard_time = 0.;
+        level = 1.f;
+        note_velocity = 127;
+        bend = 128;
+        std::fill(held_samples.begin(), held_samples.end(), 0.f);
+
+        auto current_program = std::atomic_load(&program);
+        if (current_program != nullptr)
+            current_program->resetState(vars);
+    }
+
+    // 㱾 block  tT д t_dest / T_dest / gain_destƽʱ; numSamples Ϊֵ sample 
+    // ¼µ note on / off  offset  (ģ̶ʱΪ֮ĵһֵ sample) Ч
+    // ֵʱ _8BitSynthesiser ãд voice õڱ voice һ
+    void advanceTime(int32_t* t_dest, int32_t* T_dest, float* gain_dest, int numSamples) {
+        int position = 0;
+        for (const GateEvent& event : pending_events) {
+            int offset = juce::jlimit(position, numSamples, context.hold.toEvaluated(event.offset));
+            fillTime(t_dest, T_dest, gain_dest, position, offset);
+            position = offset;
+
+            if (event.kind == GateEvent::RELEASE) {
+                releasing = frequency != 0.;
+                continue;
+            }
+            frequency = event.frequency;        // note off ʱΪ 0
+            time = 0.;
+            standard_time = 0.;
+            releasing = false;
+            level = 1.f;
         }
+        pending_events.clearQuick();
 
-        //  T 
-        double end_standard_time = standard_time + (numSamples - 1) * 256.0 * block_bpm / (sample_rate * 60.);
-        double next_standard_time = end_standard_time + 256.0 * block_bpm / (sample_rate * 60.);
-        vars["T"] = xt::cast<int32_t>(xt::linspace<double>(standard_time, end_standard_time, numSamples));
+        fillTime(t_dest, T_dest, gain_dest, position, numSamples);
 
-        //  w x y z 
-        vars["w"][0] = apvts.getRawParameterValue("w")->load();
-        vars["x"][0] = apvts.getRawParameterValue("x")->load();
-        vars["y"][0] = apvts.getRawParameterValue("y")->load();
-        vars["z"][0] = apvts.getRawParameterValue("z")->load();
+        if (frequency == 0. && isVoiceActive())     // release ˥
+            clearCurrentNote();
+    }
+
+    // ʽĸ (ȡ output_bits λ) д buffer; ÿȡ results[k] д offset ʼ numSamples  sample (ֵ sample )
+    // λΪ޷еΪ 0λ޹ (context.full_scale); ѭûз֧ɱ
+    void addOutput(juce::AudioSampleBuffer& outputBuffer, int startSample, const std::vector<fparse::EvaluationResult>& values, size_t offset, const float* gain_values, int numSamples) {
+        const uint32_t mask = (1u << context.output_bits) - 1u;
+        const int32_t half = 1 << (context.output_bits - 1);
+        const float scale = context.full_scale / static_cast<float>(half);
 
-        // 
-        xt::xarray<float> result = xt::cast<float>((expr->evaluate(vars, numSamples) % 256 + 256) % 256 - 128) / 510.0f;
-        
-        // д buffer
-        for (size_t i = 0; i < numSamples; i++) {
-            for (auto channel = outputBuffer.getNumChannels(); --channel >= 0;)
-                outputBuffer.addSample(channel, startSample + i, result[i]);
+        output.resize(static_cast<size_t>(numSamples));
+        output_level = 0.f;
+        for (size_t k = 0; k < values.size(); k++) {
+            const int32_t* source = values[k].data() + offset;
+            for (int i = 0; i < numSamples; i++)
+                output[i] = static_cast<float>(static_cast<int32_t>(static_cast<uint32_t>(source[i]) & mask) - half) * scale;
+            juce::FloatVectorOperations::multiply(output.data(), gain_values, numSamples);
+            measureOutput(numSamples);
+
+            writeOutput(outputBuffer, startSample, numSamples, k, values.size());
         }
-        
-        // ʱ
-        time = next_time;
-        standard_time = next_standard_time;
+    }
+
+    // ģʽ:  -1..1 (NaN Ϊ 0ֽض)ŵģʽͬ
+    void addFloatOutput(juce::AudioSampleBuffer& outputBuffer, int startSample, const std::vector<fparse::FloatResult>& values, size_t offset, const float* gain_values, int numSamples) {
+        output.resize(static_cast<size_t>(numSamples));
+        output_level = 0.f;
+        for (size_t k = 0; k < values.size(); k++) {
+            const float* source = values[k].data() + offset;
+            for (int i = 0; i < numSamples; i++) {
+                float value = source[i] == source[i] ? source[i] : 0.f;
+                output[i] = juce::jlimit(-1.f, 1.f, value) * context.full_scale;
+            }
+            juce::FloatVectorOperations::multiply(output.data(), gain_values, numSamples);
+            measureOutput(numSamples);
+
+            writeOutput(outputBuffer, startSample, numSamples, k, values.size());
+        }
+    }
+
+    inline bool isSounding() const {                            //  ( release) block дЧ note on / off
+        return frequency != 0. || !pending_events.isEmpty();
+    }
 
+    inline bool isReleasing() const {
+        return releasing;
+    }
+
+    // һȾֵ (ѳ˰磬)ѡ voice ռ; ס release е voice ɱȽ
+    inline float getLevel() const {
+        return output_level;
+    }
+
+    // dest йʽõ voice ԴΪ size  sample (Сʱ·ڴ)
+    static void resizeModulation(const fparse::Program& current_program, std::unordered_map<std::string, fparse::EvaluationResult>& dest, size_t size) {
+        for (const char* name : modulator_names)
+            if (current_program.uses(name))
+                dest[name].resize({ size });
+    }
+
+    //  voice ĵԴд dest  [offset, offset + count) һΣֻд빫ʽõı
+    // env Ϊ (gain_values) 㵽 0..255vel  bend в
+    void writeModulation(const fparse::Program& current_program, std::unordered_map<std::string, fparse::EvaluationResult>& dest, const float* gain_values, size_t offset, int count) const {
+        if (current_program.uses("env")) {
+            int32_t* env = dest["env"].data() + offset;
+            for (int i = 0; i < count; i++)
+                env[i] = static_cast<int32_t>(gain_values[i] * 255.f + 0.5f);
+        }
+        if (current_program.uses("vel"))
+            std::fill_n(dest["vel"].data() + offset, count, note_velocity);
+        if (current_program.uses("bend"))
+            std::fill_n(dest["bend"].data() + offset, count, bend);
     }
 
 private:
+    struct GateEvent {
+        enum Kind { NOTE_ON, NOTE_OFF, RELEASE };
+
+        int offset;
+        Kind kind;
+        double frequency;                                       // NOTE_ON Ƶ
+    };
+
     double frequency = 0.;
     double time = 0.;
     double standard_time = 0.;
     double& bpm;
 
-    std::shared_ptr<fparse::Expression>& expr;
+    std::shared_ptr<fparse::Program>& program;
     std::unordered_map<std::string, fparse::EvaluationResult> vars;
+    std::unordered_map<std::string, fparse::FloatResult> float_vars;    // ģʽеñ let 
+    RenderContext& context;
+
+    bool releasing = false;
+    float level = 1.f;                                          // release ׶εİ
+    float output_level = 0.f;                                   // һȾֵ ( getLevel)
+    int32_t note_velocity = 0;                                  // vel: һ note on  (0..127)
+    int32_t bend = 128;                                         // bend: ֵĸ 8 λ
+
+    juce::Array<GateEvent> pending_events;                      //  offset 
+    std::vector<float> gain;
+    std::vector<float> output;
+    std::vector<fparse::EvaluationResult> results;              // ʽĸ
+    std::vector<fparse::FloatResult> float_results;
+    std::vector<float> held;                                    // ױչ
+    std::vector<float> held_samples;                            // ÿһֵ sample (ѳ)ֵһֵ sample ʼ
+
+    //  w x y z 빲ĵԴ count ֵ sample д buffer (t Tvoice ĵԴѾ)
+    void evaluateBlock(const fparse::Program& current_program, juce::AudioSampleBuffer& outputBuffer, int startSample, int count) {
+        for (const auto& [name, value] : context.macros)
+            vars[name] = value;
+        for (const std::string& name : current_program.variables)     // ֻȡʽõĹԴ
+            if (auto value = context.modulation.find(name); value != context.modulation.end())
+                vars[name] = value->second;
+
+        if (current_program.float_mode) {
+            current_program.evaluateFloatOutputs(vars, float_vars, count, float_results);
+            addFloatOutput(outputBuffer, startSample, float_results, 0, gain.data(), count);
+            return;
+        }
+        current_program.evaluateOutputs(vars, count, results, context.output_bits);
+        addOutput(outputBuffer, startSample, results, 0, gain.data(), count);
+    }
+
+    // Ƶ output_bits Ϊ޷ (ͬ: еΪ 01 Ϊֽض) д in inL inRin Ϊҵƽ
+    // ֱӴ buffer ȡмĿ; ģ̶ʱȡÿֵ sample 㴦ֵ; ʱ inR  inL ͬ
+    void readInputs(const juce::AudioSampleBuffer& buffer, int startSample, int count, int inputChannels) {
+        const int32_t half = 1 << (context.output_bits - 1);
+        const float top = static_cast<float>(2 * half - 1);
+        auto quantise = [half, top](float x) {
+            x = x == x ? x : 0.f;       // NaN Ϊ 0
+            return static_cast<int32_t>(juce::jlimit(0.f, top, std::floor(x * static_cast<float>(half) + static_cast<float>(half) + 0.5f)));
+            };
+
+        fparse::EvaluationResult& in = vars["in"];
+        fparse::EvaluationResult& in_left = vars["inL"];
+        fparse::EvaluationResult& in_right = vars["inR"];
+        for (auto* value : { &in, &in_left, &in_right })
+            value->resize({ static_cast<size_t>(count) });
+
+        if (inputChannels <= 0) {
+            for (auto* value : { &in, &in_left, &in_right })
+                std::fill(value->begin(), value->end(), half);
+            return;
+        }
+
+        const float* left = buffer.getReadPointer(0, startSample);
+        const float* right = inputChannels > 1 ? buffer.getReadPointer(1, startSample) : left;
+        for (int i = 0; i < count; i++) {
+            int position = context.hold.toHost(i);
+            in_left[i] = quantise(left[position]);
+            in_right[i] = quantise(right[position]);
+            in[i] = quantise(0.5f * (left[position] + right[position]));
+        }
+    }
+
+    // output ǰ numSamples  sample ķֵ output_level
+    inline void measureOutput(int numSamples) {
+        if (numSamples <= 0)
+            return;
+        auto range = juce::FloatVectorOperations::findMinAndMax(output.data(), numSamples);
+        output_level = juce::jmax(output_level, -range.getStart(), range.getEnd());
+    }
+
+    //  k  ( outputs ) ֵõ numSamples  sample (output) ӵ buffer ; ģ̶ʱչ sample 
+    //  k д k һͬʱд (ֻһʱд)
+    void writeOutput(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples, size_t k, size_t outputs) {
+        const int channels = outputBuffer.getNumChannels();
+        if (static_cast<int>(k) >= channels)
+            return;
+
+        const float* source = output.data();
+        if (context.hold.active()) {
+            if (k >= held_samples.size())                       // δ prepare  voice; prepare ֮ٷ
+                held_samples.resize(k + 1, 0.f);
+            numSamples = context.hold.getHostSamples();
+            held.resize(static_cast<size_t>(numSamples));
+            context.hold.expand(output.data(), held_samples[k], held.data());
+            source = held.data();
+        }
+
+        const int last = k + 1 == outputs ? channels : static_cast<int>(k) + 1;
+        for (int channel = static_cast<int>(k); channel < last; channel++)
+            outputBuffer.addFrom(channel, startSample, source, numSamples);
+    }
+
+    // Եǰд [begin, end)
+    void fillTime(int32_t* t_dest, int32_t* T_dest, float* gain_dest, int begin, int end) {
+        double sample_rate = context.hold.active() ? context.hold.getEvaluationRate() : getSampleRate();
+
+        double block_bpm = bpm;
+        if (block_bpm == -1.) {
+            block_bpm = 150.;     // Ĭbpm
+        }
+
+        double time_step = 256.0 * frequency / sample_rate;
+        double standard_time_step = 256.0 * block_bpm / (sample_rate * 60.);
+        //  int32 ʱ䰴 two's complement  (double ֱתΪ int32 ʱԽδΪ)
+        auto wrap = [](double value) { return static_cast<int32_t>(static_cast<uint32_t>(static_cast<int64_t>(value))); };
+        for (int i = begin; i < end; i++)
+            t_dest[i] = wrap(time + (i - begin) * time_step);
+
+        // T: ͬʱΪλ (ÿ 256) note on ʱ޹;  note on  bpm ۼ
+        const fparse::TransportPosition& transport = context.transport;
+        if (transport.synced)
+            for (int i = begin; i < end; i++)
+                T_dest[i] = fparse::TransportPosition::standardTime(transport.ppqAt(context.render_offset + context.hold.toHost(i)));
+        else
+            for (int i = begin; i < end; i++)
+                T_dest[i] = wrap(standard_time + (i - begin) * standard_time_step);
+
+        // : δΪ 0סΪ 1release ʱ sample ˥˥Ϻֹͣ
+        if (frequency == 0.)
+            juce::FloatVectorOperations::clear(gain_dest + begin, end - begin);
+        else if (!releasing)
+            juce::FloatVectorOperations::fill(gain_dest + begin, 1.f, end - begin);
+        else {
+            for (int i = begin; i < end; i++) {
+                gain_dest[i] = level;
+                level *= context.release_coefficient;
+                if (level < silence_level) {
+                    juce::FloatVectorOperations::clear(gain_dest + i + 1, end - i - 1);
+                    frequency = 0.;
+                    releasing = false;
+                    level = 1.f;
+                    break;
+                }
+            }
+        }
+
+        // ʱ
+        time += (end - begin) * time_step;
+        standard_time += (end - begin) * standard_time_step;
+    }
+};
+
+
+//==============================================================================
+// Synthesiser 
+// ʽ״̬ʱз voice ϲΪһֵ:  voice  t / T ų voices  samples 飬
+// ÿڵֻһΣͳһֵԵԪ㲥 voice
+// ״̬ĹʽҪ sample ִ״̬ڸԵ voiceÿ voice ֵ
+//
+// renderBlock  MIDI ¼з block: ¼λü¼ voice У sample Ч
+// ֵĿ MIDI ܶ޹; w x y z  SmoothedValue ƽ sample 鴫ʽ
+//
+// ͬʱ voice  polyphony  ( max_voices)ʱ voice_stealing ռ voice
+// δ voice Ⱦ
+//
+// emulation_rate ѡ̶ģ: ʽֻڸòֵ (֮ͣ޹)ױչ;
+// output_bits ѡʽλ
+//
+// effect ģʽ (renderEffect) йʽƵ: ԣɲ voices  effect_voice ֵ
+//
+// Դ (env vel bend lfo1 lfo2 ccN) ÿ block һΣֻ㹫ʽõ (Program::variables)
+class _8BitSynthesiser : public juce::Synthesiser {
+public:
+    _8BitSynthesiser(std::shared_ptr<fparse::Program>& p, juce::AudioProcessorValueTreeState& s, PerformanceMonitor& m, double& b)
+        : program(p), apvts(s), monitor(m), bpm(b), effect_voice(p, context, b) {
+        batch_vars["T"] = fparse::EvaluationResult({ 0 });
+        batch_vars["t"] = fparse::EvaluationResult({ 0 });
+        for (const char* name : _8BitSynthVoice::input_names)
+            batch_vars[name] = fparse::EvaluationResult({ 0 });
+        for (const char* name : macro_names) {
+            batch_vars[name] = fparse::EvaluationResult({ 0 });
+            context.macros[name] = fparse::EvaluationResult({ 0 });
+        }
+        for (const char* name : lfo_names)                      // ԴļԤȽֵֻ֮
+            context.modulation[name] = fparse::EvaluationResult({ 0 });
+        for (int cc = 0; cc < 128; cc++)
+            context.modulation["cc" + std::to_string(cc)] = fparse::EvaluationResult({ 0 });
+        active_voices.ensureStorageAllocated(max_voices);      // audio thread ϲٷ
+    };
+
+    static constexpr int max_voices = 64;                   //  voice polyphony 
+    static constexpr double macro_smoothing_seconds = 0.02;
+    static constexpr const char* macro_names[] = { "w", "x", "y", "z" };
+    static constexpr double emulation_rates[] = { 0., 8000., 11025., 16000., 22050., 32000., 44100. };    // emulation_rate ѡ0 Ϊģ
+    static constexpr const char* lfo_names[] = { "lfo1", "lfo2" };
+    static constexpr double lfo_beats[] = { 0.25, 0.5, 1., 2., 4., 8., 16. };      // lfo1_rate / lfo2_rate ѡ: ÿڵ
+
+    // Ⱦ block () 󳤶 (prepareToPlay)Ԥȷױֵ voice Ļ
+    inline void prepareBuffers(int maxBlockSize, int numChannels) {
+        context.hold.prepare(maxBlockSize);
+        scaled_midi.ensureSize(scaled_midi_bytes);
+        for (int i = 0; i < getNumVoices(); i++)
+            if (auto* voice = dynamic_cast<_8BitSynthVoice*>(getVoice(i)))
+                voice->prepare(maxBlockSize, numChannels);
+        effect_voice.prepare(maxBlockSize, numChannels);
+    };
+
+    // ¼ CC ֵ ( MIDI ͨ)ദ (̤) 
+    void handleController(int midiChannel, int controllerNumber, int controllerValue) override {
+        controllers[static_cast<size_t>(controllerNumber & 127)] = controllerValue;
+        juce::Synthesiser::handleController(midiChannel, controllerNumber, controllerValue);
+    }
+
+    inline RenderContext& getRenderContext() {
+        return context;
+    };
+
+    // һ block Ĳλ (processBlock ڹ TransportPosition::setSpan)
+    inline void setTransport(const fparse::TransportPosition& position) {
+        const juce::ScopedLock sl(lock);
+        transport = position;
+    };
+
+    // Ⱦһ blockMIDI ¼λó midiPositionScale ( block еλ)
+    void renderBlock(juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& midiData, int startSample, int numSamples, int midiPositionScale = 1) {
+        const juce::ScopedLock sl(lock);
+
+        if (getSampleRate() == 0.)
+            return;
+
+        effect_active = false;
+        prepareRender(128.f / 510.f);
+
+        auto current_program = std::atomic_load(&program);
+        if (current_program != nullptr && current_program->sequential) {
+            // ״̬ note on ʱָΪʼֵ¼з; ¼λȻ㵽 block 
+            if (midiPositionScale == 1) {
+                renderNextBlock(outputAudio, midiData, startSample, numSamples);
+                return;
+            }
+            scaled_midi.clear();
+            for (const auto metadata : midiData)
+                scaled_midi.addEvent(metadata.data, metadata.numBytes,
+                    fparse::TransportPosition::eventPosition(metadata.samplePosition, midiPositionScale, startSample + numSamples));
+            renderNextBlock(outputAudio, scaled_midi, startSample, numSamples);
+            return;
+        }
+
+        for (const auto metadata : midiData) {
+            int offset = fparse::TransportPosition::eventPosition(metadata.samplePosition, midiPositionScale, startSample + numSamples);
+            context.event_offset = juce::jlimit(0, numSamples - 1, offset - startSample);
+            handleMidiEvent(metadata.getMessage());
+        }
+        context.event_offset = 0;
+
+        renderVoices(outputAudio, startSample, numSamples);
+    }
+
+    // effect ģʽ: ʽ audio ǰ inputChannels Ƶ滻 audio 
+    //  effect ģʽʱֹͣeffect_voice ͷʼ; midiData ֻ CC Ч (ӱ block 㿪ʼ)
+    void renderEffect(juce::AudioBuffer<float>& audio, const juce::MidiBuffer& midiData, int startSample, int numSamples, int inputChannels) {
+        const juce::ScopedLock sl(lock);
+
+        if (getSampleRate() == 0.)
+            return;
+
+        if (!effect_active) {
+            allNotesOff(0, false);
+            effect_voice.resetEffect();
+            effect_active = true;
+        }
+        prepareRender(1.f);
+        context.render_offset = startSample;
+
+        for (const auto metadata : midiData) {
+            const juce::MidiMessage message = metadata.getMessage();
+            if (message.isController())
+                controllers[static_cast<size_t>(message.getControllerNumber() & 127)] = message.getControllerValue();
+            else if (message.isPitchWheel())
+                effect_voice.pitchWheelMoved(message.getPitchWheelValue());
+        }
+
+        int count = context.hold.plan(numSamples);             // ֵ sample 
+        updateMacros(count);
+        if (auto current_program = std::atomic_load(&program))
+            updateModulation(*current_program, count);
+        effect_voice.setCurrentPlaybackSampleRate(getSampleRate());
+
+        auto start_ticks = juce::Time::getHighResolutionTicks();
+        effect_voice.renderEffect(audio, startSample, numSamples, inputChannels);
+        monitor.addEvaluation(juce::Time::getHighResolutionTicks() - start_ticks, count, 1);
+    }
+
+protected:
+    // ñȾֵʡλƽ release ˥ϵ
+    void prepareRender(float fullScale) {
+        int emulation = static_cast<int>(apvts.getRawParameterValue("emulation_rate")->load());
+        context.hold.setRates(getSampleRate(), emulation_rates[juce::jlimit(0, static_cast<int>(std::size(emulation_rates)) - 1, emulation)]);   // Ĳ
+        context.output_bits = juce::jlimit(1, 16, static_cast<int>(apvts.getRawParameterValue("output_bits")->load()));
+        context.full_scale = fullScale;
+        context.transport = transport;
+        context.render_offset = 0;
+        double evaluation_rate = context.hold.getEvaluationRate();
+
+        // 갴ֵ sample ƽֵֻĲʱ仯ʱãڽеƽ
+        if (evaluation_rate != smoothing_rate) {
+            for (int m = 0; m < 4; m++)
+                macro_smoothers[m].reset(evaluation_rate, macro_smoothing_seconds);
+            smoothing_rate = evaluation_rate;
+        }
+        for (int m = 0; m < 4; m++)
+            macro_smoothers[m].setTargetValue(apvts.getRawParameterValue(macro_names[m])->load());
+
+        // ˥ silence_level ʱΪ release 
+        float release_seconds = apvts.getRawParameterValue("release")->load();
+        context.release_coefficient = release_seconds > 0.f
+            ? static_cast<float>(std::pow(static_cast<double>(_8BitSynthVoice::silence_level), 1. / (release_seconds * evaluation_rate)))
+            : 0.f;
+    }
+
+    // ﵽʱʹпе voice ҲҪռ
+    juce::SynthesiserVoice* findFreeVoice(juce::SynthesiserSound* soundToPlay, int midiChannel, int midiNoteNumber, bool stealIfNoneAvailable) const override {
+        int polyphony = static_cast<int>(apvts.getRawParameterValue("polyphony")->load());
+
+        int active = 0;
+        for (auto* voice : voices)
+            if (voice->isVoiceActive())
+                active++;
+
+        if (active < polyphony)
+            return juce::Synthesiser::findFreeVoice(soundToPlay, midiChannel, midiNoteNumber, stealIfNoneAvailable);
+        return stealIfNoneAvailable ? findVoiceToSteal(soundToPlay, midiChannel, midiNoteNumber) : nullptr;
+    }
+
+    // ռ release  voice;  (ڰסʱ)  voice_stealing ѡ翪ʼһȾֵС
+    juce::SynthesiserVoice* findVoiceToSteal(juce::SynthesiserSound* soundToPlay, int, int) const override {
+        bool quietest = apvts.getRawParameterValue("voice_stealing")->load() >= 0.5f;
+
+        _8BitSynthVoice* candidate = nullptr;
+        for (auto* voice : voices) {
+            auto* synth_voice = dynamic_cast<_8BitSynthVoice*>(voice);
+            if (synth_voice == nullptr || !synth_voice->isVoiceActive() || !synth_voice->canPlaySound(soundToPlay))
+                continue;
+            if (candidate == nullptr) {
+                candidate = synth_voice;
+                continue;
+            }
+
+            if (synth_voice->isReleasing() != candidate->isReleasing()) {
+                if (synth_voice->isReleasing())
+                    candidate = synth_voice;
+                continue;
+            }
+            if (quietest && synth_voice->getLevel() != candidate->getLevel()) {
+                if (synth_voice->getLevel() < candidate->getLevel())
+                    candidate = synth_voice;
+                continue;
+            }
+            if (synth_voice->wasStartedBefore(*candidate))
+                candidate = synth_voice;
+        }
+        return candidate;
+    }
+
+    void renderVoices(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples) override {
+        context.render_offset = startSample;
+        int count = context.hold.plan(numSamples);             // ֵ sample 
+        updateMacros(count);
+
+        auto current_program = std::atomic_load(&program);
+        if (current_program == nullptr)         // ʽδ
+            return;
+        updateModulation(*current_program, count);
+
+        active_voices.clearQuick();
+        for (auto* voice : voices)
+            if (auto* synth_voice = dynamic_cast<_8BitSynthVoice*>(voice))
+                if (synth_voice->isSounding())
+                    active_voices.add(synth_voice);
+
+        auto start_ticks = juce::Time::getHighResolutionTicks();
+
+        // ״ֻ̬һ voice ʱûпԺϲֵ
+        if (current_program->sequential || active_voices.size() <= 1) {
+            for (auto* voice : active_voices)
+                voice->renderNextBlock(outputAudio, startSample, numSamples);
+            monitor.addEvaluation(juce::Time::getHighResolutionTicks() - start_ticks, active_voices.size() * count, active_voices.size());
+            return;
+        }
+
+        //  t, T :  v  voice ռ [v * count, (v + 1) * count)
+        size_t batch_size = static_cast<size_t>(active_voices.size()) * count;
+        fparse::EvaluationResult& t = batch_vars["t"];
+        fparse::EvaluationResult& T = batch_vars["T"];
+        t.resize({ batch_size });                   // Сʱ·ڴ
+        T.resize({ batch_size });
+        batch_gain.resize(batch_size);
+        for (int v = 0; v < active_voices.size(); v++)
+            active_voices[v]->advanceTime(t.data() + v * count, T.data() + v * count, batch_gain.data() + v * count, count);
+
+        // voice ĵԴ (ʽõ):  t ͬ voice 
+        _8BitSynthVoice::resizeModulation(*current_program, batch_vars, batch_size);
+        for (int v = 0; v < active_voices.size(); v++)
+            active_voices[v]->writeModulation(*current_program, batch_vars, batch_gain.data() + v * count, static_cast<size_t>(v * count), count);
+
+        //  w x y z 빲ĵԴ ( voice ): ʱ㲥Ԫ飬 sample 仯ʱΪÿ voice һ
+        auto broadcast = [&](const std::string& name, const fparse::EvaluationResult& ramp) {
+            fparse::EvaluationResult& value = batch_vars[name];
+            if (ramp.size() == 1) {
+                value = ramp;
+                return;
+            }
+            value.resize({ batch_size });
+            for (int v = 0; v < active_voices.size(); v++)
+                std::copy(ramp.begin(), ramp.end(), value.begin() + v * count);
+            };
+        for (const char* name : macro_names)
+            broadcast(name, context.macros[name]);
+        for (const std::string& name : current_program->variables)
+            if (auto ramp = context.modulation.find(name); ramp != context.modulation.end())
+                broadcast(name, ramp->second);
+
+        // ϳģʽûƵ
+        for (const char* name : _8BitSynthVoice::input_names) {
+            batch_vars[name].resize({ 1 });
+            batch_vars[name][0] = 1 << (context.output_bits - 1);
+        }
+
+        // ٰ voice 
+        if (current_program->float_mode) {
+            current_program->evaluateFloatOutputs(batch_vars, batch_float_vars, batch_size, batch_float_results);
+            for (int v = 0; v < active_voices.size(); v++)
+                active_voices[v]->addFloatOutput(outputAudio, startSample, batch_float_results, static_cast<size_t>(v * count), batch_gain.data() + v * count, count);
+        }
+        else {
+            current_program->evaluateOutputs(batch_vars, batch_size, batch_results, context.output_bits);
+            for (int v = 0; v < active_voices.size(); v++)
+                active_voices[v]->addOutput(outputAudio, startSample, batch_results, static_cast<size_t>(v * count), batch_gain.data() + v * count, count);
+        }
+
+        monitor.addEvaluation(juce::Time::getHighResolutionTicks() - start_ticks, static_cast<int>(batch_size), active_voices.size());
+    }
+
+private:
+    std::shared_ptr<fparse::Program>& program;
     juce::AudioProcessorValueTreeState& apvts;
+    PerformanceMonitor& monitor;
+    double& bpm;
+
+    RenderContext context;
+    juce::SmoothedValue<float> macro_smoothers[4];
+    double smoothing_rate = 0.;                             // macro_smoothers ǰʹõĲ
+    _8BitSynthVoice effect_voice;                           // effect ģʽֵ voice ()
+    bool effect_active = false;                             // һȾǷΪ effect ģʽ
+    std::array<int32_t, 128> controllers{};                 // յ CC ֵ
+    double lfo_phases[2] = { 0., 0. };                      // lfo1 lfo2 λ ()
+    fparse::TransportPosition transport;                    // processBlock ĲλãȾʱƵ context
+
+    std::unordered_map<std::string, fparse::EvaluationResult> batch_vars;  // ϲֵı block 
+    std::unordered_map<std::string, fparse::FloatResult> batch_float_vars;
+    std::vector<float> batch_gain;
+    std::vector<fparse::EvaluationResult> batch_results;       // ϲֵĸ
+    std::vector<fparse::FloatResult> batch_float_results;
+    juce::Array<_8BitSynthVoice*> active_voices;
+    juce::MidiBuffer scaled_midi;                           // ״̬Ĺʽ: λû㵽 MIDI ¼ block 
+    static constexpr int scaled_midi_bytes = 4096;          // Ԥȷһ block е¼ʱ audio thread Ϸ
+
+    // 㹫ʽõĹԴĽ numSamples ֵ sample (ڹʱȫֻдֵaudio thread ϲɾ)
+    // lfo1 / lfo2:  bpm ͬ (0..255 sin() ʹͬһű)λδõʱҲճƽ; ccN: յֵ block 
+    // ͬʱ lfo λɲλø (ÿڴ lfo_beats ʼ)
+    void updateModulation(const fparse::Program& current_program, int numSamples) {
+        double block_bpm = bpm == -1. ? 150. : bpm;     //  voice  T ͬĬ bpm
+        for (int l = 0; l < 2; l++) {
+            int choice = static_cast<int>(apvts.getRawParameterValue(l == 0 ? "lfo1_rate" : "lfo2_rate")->load());
+            double beats = lfo_beats[juce::jlimit(0, static_cast<int>(std::size(lfo_beats)) - 1, choice)];
+            double step = block_bpm / (60. * context.hold.getEvaluationRate() * beats);     // ÿֵ sample λ
+
+            const fparse::TransportPosition& transport = context.transport;
+            auto phaseAt = [&](int i) {
+                return transport.synced ? transport.ppqAt(context.render_offset + context.hold.toHost(i)) / beats : lfo_phases[l] + i * step;
+                };
+            if (current_program.uses(lfo_names[l])) {
+                fparse::EvaluationResult& ramp = context.modulation[lfo_names[l]];
+                ramp.resize({ static_cast<size_t>(numSamples) });
+                for (int i = 0; i < numSamples; i++) {
+                    double phase = phaseAt(i);
+                    ramp[i] = fparse::FormulaParser::sine_table[static_cast<size_t>((phase - std::floor(phase)) * 256.) & 255];
+                }
+            }
+            if (numSamples > 0)
+                lfo_phases[l] = phaseAt(numSamples - 1) + step;  // ֹͣͬӵǰλ
+            lfo_phases[l] -= std::floor(lfo_phases[l]);
+        }
+
+        for (const std::string& name : current_program.variables) {
+            if (name.size() < 3 || name.compare(0, 2, "cc") != 0)
+                continue;
+            auto value = context.modulation.find(name);
+            if (value == context.modulation.end())                  //  cc ͷ
+                continue;
+            value->second.resize({ 1 });
+            value->second[0] = controllers[static_cast<size_t>(std::atoi(name.c_str() + 2) & 127)];
+        }
+    }
+
+    // ȡ numSamples ƽĺֵ
+    void updateMacros(int numSamples) {
+        for (int m = 0; m < 4; m++) {
+            fparse::EvaluationResult& ramp = context.macros[macro_names[m]];
+            if (!macro_smoothers[m].isSmoothing()) {
+                ramp.resize({ 1 });
+                ramp[0] = static_cast<int32_t>(macro_smoothers[m].getCurrentValue());
+                continue;
+            }
+            ramp.resize({ static_cast<size_t>(numSamples) });
+            for (int i = 0; i < numSamples; i++)
+                ramp[i] = static_cast<int32_t>(macro_smoothers[m].getNextValue());
+        }
+    }
 };
 
 
@@ -213,16 +1143,27 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
 
     
+    static constexpr int state_version = 1;            // getStateInformation ĸʽ汾ʽıʱ
     static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
+    static constexpr int max_oversampling_factor = 4;   // juce::dsp::Oversampling ֧ 4  (16 )
+    static int getOversamplingRatio(int factor);        // processSamplesUp  sample ֮ (Oversampling  factor Ϊ)synth Ĳ븺عƾô˱
     juce::AudioProcessorValueTreeState apvts{ *this, nullptr, "Parameters", createParameterLayout() };
 
     //==============================================================================
     FormulaManager formula_manager;                     // ʽ
+    PerformanceMonitor performance_monitor;             // ÿ block ĺʱн editor
+    ScopeTap scope_tap;                                 // Σн editor ʾ
 
 private:
     //==============================================================================
+    bool checkFormulaBudget(fparse::ParseResult& result, bool commit);  // Ƶ DSP  cpu_budget Ƚϣ budget_action 
+    void setOversamplingFactor(int factor);             // ޸ oversampling_factor ؽ (message thread)
+    void setPresetMacros(const PresetEntry& preset);    // д preset ָ w x y z (message thread)
+
     fparse::FormulaParser parser;                       // parser
-    juce::Synthesiser synth;                            // synth
+    PresetBank preset_bank{ parser };                   // program б̨Ԥȱ
+    std::array<juce::RangedAudioParameter*, 4> macro_parameters{};     // w x y z
+    _8BitSynthesiser synth{ formula_manager.getProgram(), apvts, performance_monitor, bpm };   // synth
     double bpm = 0.;                                    // bpm
 
     std::unique_ptr<juce::dsp::Oversampling<float>> oversampler;
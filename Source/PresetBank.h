@@ -0,0 +1,180 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "FormulaParser.h"
+#include "FormulaCache.h"
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+//==============================================================================
+// һ preset: ʽ w x y z ֵ
+// ļʽ (*.bapreset): <Preset w="0" x="12" y="0" z="255"><Formula>t*(t>>12|t>>8)&amp;63</Formula></Preset>
+// ʡԵ macro Ϊ -1лʱֵǰֵ
+struct PresetEntry {
+    enum Status { UNLOADED, READY, FAILED };
+
+    juce::File file;
+    juce::String name;                                          // ļ (չ)ʱȡļ
+
+    // ɺ̨߳ status Ϊ READY ֮ǰд룬ֻ֮
+    std::atomic<int> status{ UNLOADED };
+    std::string formula;
+    std::array<int, 4> macros{ -1, -1, -1, -1 };
+    std::shared_ptr<fparse::Program> program;
+
+    inline bool isReady() const {
+        return status.load(std::memory_order_acquire) == READY;
+    };
+};
+
+
+//==============================================================================
+// Preset 
+// ʱֻгĿ¼еļ; ̨̰ܱ߳ʹõ˳ (ġǰ preset ǰ) ȡ
+//  FormulaCache ֮ select ֻ轻ѱ program audio thread ϵ
+// select ֻдԭӵ requested message thread ϵ timer ȡpreset  message thread ϵ onSelected
+// (AsyncUpdater ϢͶϢ audio thread ϴ)
+class PresetBank : private juce::Thread, private juce::Timer {
+public:
+    static constexpr const char* file_pattern = "*.bapreset";
+    static constexpr int poll_interval_ms = 30;                 //  requested ļ
+
+    std::function<void(const PresetEntry&)> onSelected;         // ѡе preset Ѿ (message thread)ڸ¹ʽı editor
+
+    PresetBank(fparse::FormulaParser& formula_parser, const juce::File& directory = getDefaultDirectory())
+        : juce::Thread("PresetBank"), parser(formula_parser) {
+        if (directory.isDirectory()) {
+            juce::Array<juce::File> files = directory.findChildFiles(juce::File::findFiles, false, file_pattern);
+            files.sort();                                       // ļ򣬱֤ program ڸμ֮䲻
+            for (const juce::File& file : files) {
+                auto entry = std::make_unique<PresetEntry>();
+                entry->file = file;
+                entry->name = file.getFileNameWithoutExtension();
+                entries.push_back(std::move(entry));
+            }
+        }
+        if (!entries.empty()) {
+            startThread(juce::Thread::Priority::low);
+            startTimer(poll_interval_ms);                       //  message thread Ϲ
+        }
+    };
+
+    ~PresetBank() override {
+        stopTimer();
+        stopThread(2000);
+    };
+
+    static juce::File getDefaultDirectory() {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("BitAlchemy").getChildFile("Presets");
+    };
+
+    inline int size() const {
+        return static_cast<int>(entries.size());
+    };
+
+    inline juce::String getName(int index) const {
+        return isPositiveAndBelow(index) ? entries[index]->name : juce::String();
+    };
+
+    inline int getCurrentIndex() const {
+        return current.load();
+    };
+
+    inline void setCurrentIndex(int index) {                    // ֻ¼ (ָʱʽ״ָ̬)
+        if (isPositiveAndBelow(index)) {
+            current = index;
+            notify();
+        }
+    };
+
+    // ѡ preset (̣߳)
+    // ѱʱظ preset߿ֱӽ program; 򷵻 nullptr
+    //  onSelected Ժ timer  message thread ϵ (¹ʽı macro)
+    inline const PresetEntry* select(int index) {
+        if (!isPositiveAndBelow(index))
+            return nullptr;
+
+        current = index;
+        requested = index;
+        PresetEntry& entry = *entries[index];
+        if (entry.isReady())
+            return &entry;
+        notify();                                               // ų́߳ȱ
+        return nullptr;
+    };
+
+private:
+    fparse::FormulaParser& parser;
+    std::vector<std::unique_ptr<PresetEntry>> entries;          // ɾ
+    std::atomic<int> current{ 0 };
+    std::atomic<int> requested{ -1 };                           // ȴ onSelected  select
+
+    inline bool isPositiveAndBelow(int index) const {
+        return index >= 0 && index < size();
+    };
+
+    // һҪ preset: ȣΰ뵱ǰ preset ľ (һǰһ)
+    int nextToCompile() const {
+        int wanted = requested.load();
+        if (isPositiveAndBelow(wanted) && entries[wanted]->status.load() == PresetEntry::UNLOADED)
+            return wanted;
+
+        int centre = current.load();
+        for (int distance = 0; distance < size(); distance++)
+            for (int index : { centre + distance, centre - distance })
+                if (isPositiveAndBelow(index) && entries[index]->status.load() == PresetEntry::UNLOADED)
+                    return index;
+        return -1;
+    };
+
+    void load(PresetEntry& entry) {
+        std::unique_ptr<juce::XmlElement> xml = juce::XmlDocument::parse(entry.file);
+        if (xml == nullptr || !xml->hasTagName("Preset")) {
+            entry.status.store(PresetEntry::FAILED, std::memory_order_release);
+            return;
+        }
+
+        static const char* macro_names[4] = { "w", "x", "y", "z" };
+        for (int m = 0; m < 4; m++)
+            if (xml->hasAttribute(macro_names[m]))
+                entry.macros[m] = juce::jlimit(0, 255, xml->getIntAttribute(macro_names[m]));
+
+        juce::XmlElement* formula = xml->getChildByName("Formula");
+        entry.formula = formula != nullptr ? formula->getAllSubText().toStdString() : std::string();
+
+        fparse::ParseResult result = fparse::FormulaCache::getInstance().parse(parser, entry.formula);
+        entry.program = result.program;
+        entry.status.store(result.success ? PresetEntry::READY : PresetEntry::FAILED, std::memory_order_release);
+    };
+
+    void run() override {
+        while (!threadShouldExit()) {
+            int index = nextToCompile();
+            if (index < 0) {                                    // ȫ
+                wait(-1);
+                continue;
+            }
+
+            load(*entries[index]);                              //  preset  timer 
+        }
+    };
+
+    void timerCallback() override {
+        int index = requested.load();
+        if (!isPositiveAndBelow(index))
+            return;
+
+        PresetEntry& entry = *entries[index];
+        if (entry.status.load() == PresetEntry::UNLOADED)       // ڱ룬´ټ
+            return;
+        requested.compare_exchange_strong(index, -1);
+        if (entry.isReady() && onSelected)                      // ʧܵ preset ԣֵǰʽ
+            onSelected(entry);
+    };
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+
+
+//==============================================================================
+// ̶ģ ( 8 kHz  bytebeat)
+// ʽֻģĲֵÿֵױ (sample and hold) չĲ
+// ģ sample  sample λÿʼ (ֵ)λ block ; ģĲΪ 0 򲻵Ĳʱ
+// ֻ audio thread ʹ; starts  prepare Ԥȷ (prepareToPlay)audio thread ϲٷ
+class SampleHold {
+public:
+    // Ԥȷһ block (ʣ)  maxBlockSize  (message threadprocessBlock ִʱ)
+    inline void prepare(int maxBlockSize) {
+        starts.ensureStorageAllocated(maxBlockSize);
+    };
+
+    //  () ģĲʸıʱ block ¿ʼ
+    inline void setRates(double host_rate, double emulated_rate) {
+        if (host_rate == host && emulated_rate == emulated)
+            return;
+        host = host_rate;
+        emulated = emulated_rate;
+        step = active() ? host / emulated : 1.;
+        next = 0.;
+    };
+
+    inline bool active() const {
+        return emulated > 0. && emulated < host;
+    };
+
+    inline double getEvaluationRate() const {                  // ʽֵĲ
+        return active() ? emulated : host;
+    };
+
+    // 㱾 block ( numSamples  sample) ÿģ sample 㣬ֵ sample 
+    inline int plan(int numSamples) {
+        host_samples = numSamples;
+        starts.clearQuick();
+        if (!active())
+            return evaluated_samples = numSamples;
+
+        while (std::ceil(next) < numSamples) {
+            starts.add(static_cast<int>(std::ceil(next)));
+            next += step;
+        }
+        next -= numSamples;
+        return evaluated_samples = starts.size();
+    };
+
+    inline int getHostSamples() const {
+        return host_samples;
+    };
+
+    inline int getEvaluatedSamples() const {
+        return evaluated_samples;
+    };
+
+    //  sample λ -> ڸλû֮ʼĵһģ sample  (MIDI ¼ӴЧ)
+    inline int toEvaluated(int offset) const {
+        if (!active())
+            return offset;
+        return static_cast<int>(std::lower_bound(starts.begin(), starts.end(), offset) - starts.begin());
+    };
+
+    //  k ֵ sample  block еλ (Ƶȡ)
+    inline int toHost(int k) const {
+        return active() ? starts[k] : k;
+    };
+
+    // ױ: ֵõ values չΪ host_samples  sample д dest
+    // һ֮ǰһ block ֵ heldʱ held Ϊ block ֵ
+    inline void expand(const float* values, float& held, float* dest) const {
+        int position = 0;
+        for (int k = 0; k < starts.size(); k++) {
+            juce::FloatVectorOperations::fill(dest + position, held, starts[k] - position);
+            position = starts[k];
+            held = values[k];
+        }
+        juce::FloatVectorOperations::fill(dest + position, held, host_samples - position);
+    };
+
+private:
+    double host = 0.;
+    double emulated = 0.;
+    double step = 1.;                                           // ÿģ sample ռ sample ĸ
+    double next = 0.;                                           // һģ sample  block λ
+    int host_samples = 0;
+    int evaluated_samples = 0;
+    juce::Array<int> starts;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+//==============================================================================
+// εĳͷ
+// audio thread  processBlock ĩβ push: ȡƽÿ decimation  sample ƽΪһд뵥ߵߵĻλ
+// editor  ScopeView  message thread ϶; û ScopeView ʱ (enabled Ϊ false) push ֱӷ
+// ʱݣaudio thread ӲȴҲڴ
+class ScopeTap {
+public:
+    static constexpr int fifo_size = 1 << 14;                  // Լ 0.7 s (24 kHz)
+    static constexpr double target_rate = 24000.;              // ȡĿʣƵʾ 12 kHz
+
+    inline void prepare(double sampleRate) {                   // prepareToPlayprocessBlock ִ
+        decimation = juce::jmax(1, juce::roundToInt(sampleRate / target_rate));
+        tap_rate = sampleRate / decimation;
+        accumulator = 0.f;
+        accumulated = 0;
+    };
+
+    inline void push(const juce::AudioBuffer<float>& buffer, int numSamples) {    // audio thread
+        if (!enabled.load(std::memory_order_relaxed))
+            return;
+
+        int channels = juce::jmin(buffer.getNumChannels(), 2);
+        if (channels == 0)
+            return;
+        const float* const* data = buffer.getArrayOfReadPointers();
+        float scale = 1.f / static_cast<float>(channels * decimation);
+
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite((accumulated + numSamples) / decimation, start1, size1, start2, size2);
+        int capacity = size1 + size2;
+        int written = 0;
+
+        for (int i = 0; i < numSamples; i++) {
+            accumulator += channels == 2 ? data[0][i] + data[1][i] : data[0][i];
+            if (++accumulated < decimation)
+                continue;
+
+            if (written < capacity) {
+                samples[written < size1 ? start1 + written : start2 + written - size1] = accumulator * scale;
+                written++;
+            }
+            else
+                dropped_samples++;
+            accumulator = 0.f;
+            accumulated = 0;
+        }
+        fifo.finishedWrite(written);
+    };
+
+    inline int pop(float* destination, int maxSamples) {      // message threadض sample 
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(maxSamples, start1, size1, start2, size2);
+        std::copy(samples.begin() + start1, samples.begin() + start1 + size1, destination);
+        std::copy(samples.begin() + start2, samples.begin() + start2 + size2, destination + size1);
+        fifo.finishedRead(size1 + size2);
+        return size1 + size2;
+    };
+
+    inline double getRate() const {                            //  sample Ĳ
+        return tap_rate.load();
+    };
+
+    std::atomic<bool> enabled{ false };                        //  ScopeView ڹ / ʱ
+    std::atomic<uint64_t> dropped_samples{ 0 };                // ScopeView ȡ
+
+private:
+    juce::AbstractFifo fifo{ fifo_size };
+    std::array<float, fifo_size> samples{};
+
+    int decimation = 1;
+    std::atomic<double> tap_rate{ target_rate };
+    float accumulator = 0.f;
+    int accumulated = 0;
+};
@@ -0,0 +1,148 @@
+#include "ScopeView.h"
+#include <algorithm>
+#include <cmath>
+
+//==============================================================================
+ScopeView::ScopeView(ScopeTap& scope_tap) : tap(scope_tap)
+{
+    history.assign(history_size, 0.f);
+    read_buffer.assign(ScopeTap::fifo_size, 0.f);
+    snapshot.assign(history_size, 0.f);
+    fft_data.assign(fft_size * 2, 0.f);                     // performFrequencyOnlyForwardTransform Ҫ 2 Ŀռ
+    spectrum_db.assign(fft_size / 2, min_db);
+
+    setOpaque(true);
+    tap.enabled = true;
+    startTimerHz(refresh_hz);
+}
+
+ScopeView::~ScopeView()
+{
+    stopTimer();
+    tap.enabled = false;
+}
+
+void ScopeView::paint(juce::Graphics& g)
+{
+    if (image.isValid())
+        g.drawImageAt(image, 0, 0);
+    else
+        g.fillAll(juce::Colours::black);
+}
+
+void ScopeView::resized()
+{
+    if (getWidth() > 0 && getHeight() > 0)
+        image = juce::Image(juce::Image::RGB, getWidth(), getHeight(), true);
+    else
+        image = {};
+    render();
+}
+
+void ScopeView::timerCallback()
+{
+    // µ sampleֻ history_size 
+    bool updated = false;
+    int count;
+    while ((count = tap.pop(read_buffer.data(), static_cast<int>(read_buffer.size()))) > 0) {
+        for (int i = 0; i < count; i++) {
+            history[history_position] = read_buffer[i];
+            history_position = (history_position + 1) % history_size;
+        }
+        updated = true;
+    }
+
+    if (updated) {                                          // δڲʱػ
+        render();
+        repaint();
+    }
+}
+
+void ScopeView::render()
+{
+    if (!image.isValid())
+        return;
+
+    std::copy(history.begin() + history_position, history.end(), snapshot.begin());
+    std::copy(history.begin(), history.begin() + history_position, snapshot.end() - history_position);
+
+    juce::Graphics g(image);
+    g.fillAll(juce::Colours::black);
+
+    auto bounds = image.getBounds().toFloat();
+    auto waveform_area = bounds.removeFromTop(bounds.getHeight() * 0.5f);
+    drawWaveform(g, waveform_area.reduced(2.f));
+    drawSpectrum(g, bounds.reduced(2.f));
+}
+
+void ScopeView::drawWaveform(juce::Graphics& g, juce::Rectangle<float> area)
+{
+    g.setColour(juce::Colours::darkgrey);
+    g.drawHorizontalLine(juce::roundToInt(area.getCentreY()), area.getX(), area.getRight());
+
+    // ڽһѰع㣬ʹԵĲڻб־ֹ; Ҳʱʾ sample
+    const int shown = history_size / 2;
+    int start = history_size - shown;
+    for (int i = history_size - shown; i > 0; i--)
+        if (snapshot[i - 1] < 0.f && snapshot[i] >= 0.f) {
+            start = i;
+            break;
+        }
+
+    juce::Path path;
+    for (int i = 0; i < shown; i++) {
+        float x = area.getX() + area.getWidth() * i / (shown - 1);
+        float y = area.getCentreY() - juce::jlimit(-1.f, 1.f, snapshot[start + i]) * area.getHeight() * 0.5f;
+        if (i == 0)
+            path.startNewSubPath(x, y);
+        else
+            path.lineTo(x, y);
+    }
+    g.setColour(juce::Colour(98, 228, 117));
+    g.strokePath(path, juce::PathStrokeType(1.f));
+}
+
+void ScopeView::drawSpectrum(juce::Graphics& g, juce::Rectangle<float> area)
+{
+    //  fft_size  sample
+    std::fill(fft_data.begin(), fft_data.end(), 0.f);
+    std::copy(snapshot.end() - fft_size, snapshot.end(), fft_data.begin());
+    window.multiplyWithWindowingTable(fft_data.data(), static_cast<size_t>(fft_size));
+    fft.performFrequencyOnlyForwardTransform(fft_data.data());
+
+    const float reference = fft_size * 0.25f;               // Ҿ Hann ķֵ
+    for (int bin = 0; bin < fft_size / 2; bin++) {
+        float db = juce::Decibels::gainToDecibels(fft_data[bin] / reference, min_db);
+        spectrum_db[bin] = juce::jmax(db, spectrum_db[bin] - decay_db);
+    }
+
+    // Ƶ: 20 Hz  Nyquist
+    const double nyquist = tap.getRate() * 0.5;
+    const double min_frequency = 20.;
+    auto frequencyToX = [&](double frequency) {
+        return area.getX() + area.getWidth() * static_cast<float>(std::log(frequency / min_frequency) / std::log(nyquist / min_frequency));
+    };
+
+    g.setColour(juce::Colours::darkgrey);
+    for (double frequency : { 100., 1000., 10000. })
+        if (frequency < nyquist)
+            g.drawVerticalLine(juce::roundToInt(frequencyToX(frequency)), area.getY(), area.getBottom());
+
+    juce::Path path;
+    bool started = false;
+    for (int bin = 1; bin < fft_size / 2; bin++) {
+        double frequency = bin * nyquist * 2. / fft_size;
+        if (frequency < min_frequency)
+            continue;
+        float x = frequencyToX(frequency);
+        float y = juce::jmap(spectrum_db[bin], min_db, 0.f, area.getBottom(), area.getY());
+        if (!started) {
+            path.startNewSubPath(x, y);
+            started = true;
+        }
+        else
+            path.lineTo(x, y);
+    }
+    g.setColour(juce::Colour(231, 228, 98));
+    g.strokePath(path, juce::PathStrokeType(1.f));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "ScopeTap.h"
+#include <vector>
+
+
+//==============================================================================
+// ʾƵ
+//  refresh_hz  ScopeTap µ sampleƵ Image ; paint ֻƸ ImageػĿ빫ʽ͸޹
+// ϰ벿Ϊ (ع㴥)°벿ΪƵƵ (Hann ֵ)
+class ScopeView : public juce::Component, private juce::Timer {
+public:
+    static constexpr int refresh_hz = 30;
+    static constexpr int fft_order = 11;
+    static constexpr int fft_size = 1 << fft_order;
+    static constexpr int history_size = fft_size * 2;          //  sample ѰҴ
+    static constexpr float min_db = -90.f;
+    static constexpr float decay_db = 1.5f;                    // ÿˢƵ׷ֵ dB
+
+    explicit ScopeView(ScopeTap& scope_tap);
+    ~ScopeView() override;
+
+    void paint(juce::Graphics& g) override;
+    void resized() override;
+
+private:
+    ScopeTap& tap;
+
+    std::vector<float> history;                                // λ壬history_position Ϊɵ sample
+    int history_position = 0;
+    std::vector<float> read_buffer;
+    std::vector<float> snapshot;                               // ʱ˳չ history
+
+    juce::dsp::FFT fft{ fft_order };
+    juce::dsp::WindowingFunction<float> window{ static_cast<size_t>(fft_size), juce::dsp::WindowingFunction<float>::hann };
+    std::vector<float> fft_data;
+    std::vector<float> spectrum_db;
+
+    juce::Image image;                                         // Ļƽ
+
+    void timerCallback() override;
+    void render();
+    void drawWaveform(juce::Graphics& g, juce::Rectangle<float> area);
+    void drawSpectrum(juce::Graphics& g, juce::Rectangle<float> area);
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ScopeView)
+};
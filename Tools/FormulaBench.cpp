@@ -0,0 +1,164 @@
+// 公式引擎基准测试
+// 比较 PRATT 与 PEG 两种解析后端的首次解析开销 (插件实例化后的第一次解析；PEG 包括语法编译) 与稳态解析延迟，
+// 并检查两者对同一公式得到相同的表达式树；
+// 另外比较小 block 多 voice 时逐个 voice 求值与所有 voice 合并为一次求值 (_8BitSynthesiser::renderVoices) 的开销，
+// 以及顶层为回绕运算的输出在窄 lane (evaluate8 / evaluate16) 与 int32 中求值的开销，并检查两者的低位一致
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <xtensor/xarray.hpp>
+#include <xtensor/xbuilder.hpp>
+
+#include "FormulaParser.h"
+
+using namespace fparse;
+using namespace std;
+
+static const vector<string> formulas = {
+	"t*(t>>12|t>>8)&63",
+	"t*(42&t>>10)",
+	"(t*5&t>>7)|(t*3&t>>10)",
+	"sin(t) + tri(T >> 2) ^ (w * x) & 255",
+	"t * ((t >> 9 | t >> 13) & 25 & t >> 6)",
+	"let a = t >> 10; let b = (a & 42) * t; b ^ (b >> 8) | sin(a + T)",
+	"state acc = 0; acc = acc + (t >> 8) & 255; acc ^ t",
+	"/* comment */ (t >> 6 | t | t >> (t >> 16)) * 10 + ((t >> 11) & 7) // trailing",
+};
+
+static double elapsedMicroseconds(chrono::steady_clock::time_point start) {
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// 构造解析器并完成第一次解析所需的时间，即插件实例化并第一次提交公式的开销
+static double measureFirstParse(FormulaParser::Backend backend, const string& formula) {
+	auto start = chrono::steady_clock::now();
+	FormulaParser parser(backend);
+	ParseResult result = parser.parse(formula);
+	double elapsed = elapsedMicroseconds(start);
+	if (!result.success)
+		printf("  parse failed: %s\n", result.msg.c_str());
+	return elapsed;
+}
+
+static double measureParse(const FormulaParser& parser, const string& formula, int iterations) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		parser.parse(formula);
+	return elapsedMicroseconds(start) / iterations;
+}
+
+// 长度为 lanes 的输入变量
+static unordered_map<string, EvaluationResult> makeVars(const Program& program, size_t lanes) {
+	unordered_map<string, EvaluationResult> vars;
+	vars["t"] = xt::arange<int32_t>(0, int32_t(lanes)) * 3;
+	vars["T"] = xt::arange<int32_t>(0, int32_t(lanes));
+	for (const char* macro : { "w", "x", "y", "z" })
+		vars[macro] = EvaluationResult({ 17 });
+	for (const char* input : { "in", "inL", "inR" })
+		vars[input] = xt::arange<int32_t>(0, int32_t(lanes)) % 256;
+	for (const string& name : program.variables)		// 调制源
+		if (vars.count(name) == 0)
+			vars[name] = EvaluationResult({ 64 });
+	return vars;
+}
+
+// voices 个 voice 各求值 block_size 个 sample 的平均时间 (us per block)
+// batched 时 t 排成 voices × block_size 的连续数组，一次求值
+static double measureVoices(const Program& program, size_t voices, size_t block_size, bool batched, int iterations) {
+	size_t lanes = batched ? voices * block_size : block_size;
+	vector<unordered_map<string, EvaluationResult>> voice_vars(batched ? 1 : voices, makeVars(program, lanes));
+
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		for (auto& vars : voice_vars)
+			program.evaluate(vars, lanes);
+	return elapsedMicroseconds(start) / iterations;
+}
+
+template <typename Evaluate>
+static double measureEvaluation(Evaluate evaluate, int iterations) {
+	evaluate();			// 预热
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		evaluate();
+	return elapsedMicroseconds(start) / iterations;
+}
+
+int main(int argc, char* argv[]) {
+	int iterations = argc > 1 ? stoi(argv[1]) : 2000;
+
+	printf("first parse after instantiation (us)\n");
+	printf("  pratt: %10.2f\n", measureFirstParse(FormulaParser::Backend::PRATT, formulas[0]));
+	printf("  peg:   %10.2f  (includes grammar compile)\n", measureFirstParse(FormulaParser::Backend::PEG, formulas[0]));
+	printf("  peg:   %10.2f  (grammar already compiled in this process)\n", measureFirstParse(FormulaParser::Backend::PEG, formulas[0]));
+
+	FormulaParser pratt(FormulaParser::Backend::PRATT);
+	FormulaParser peg(FormulaParser::Backend::PEG);
+
+	printf("\nparse latency, %d iterations (us per parse)\n", iterations);
+	printf("  %10s %10s %8s  %s\n", "pratt", "peg", "speedup", "formula");
+
+	int mismatches = 0;
+	for (const string& formula : formulas) {
+		ParseResult pratt_result = pratt.parse(formula);
+		ParseResult peg_result = peg.parse(formula);
+		if (pratt_result.success != peg_result.success ||
+			(pratt_result.success && pratt_result.program->toString() != peg_result.program->toString())) {
+			printf("  MISMATCH: %s\n", formula.c_str());
+			mismatches++;
+			continue;
+		}
+
+		double pratt_time = measureParse(pratt, formula, iterations);
+		double peg_time = measureParse(peg, formula, iterations);
+		printf("  %10.2f %10.2f %7.1fx  %s\n", pratt_time, peg_time, peg_time / pratt_time, formula.c_str());
+	}
+
+	printf("\nvoice evaluation, 16 voices (us per block)\n");
+	printf("  %6s %10s %10s %8s  %s\n", "block", "per-voice", "batched", "speedup", "formula");
+	for (const string& formula : formulas) {
+		ParseResult result = pratt.parse(formula);
+		if (!result.success || result.program->sequential)		// 含状态变量的公式不合并求值
+			continue;
+		for (size_t block_size : { 32, 64, 512 }) {
+			double per_voice = measureVoices(*result.program, 16, block_size, false, iterations / 10 + 1);
+			double batched = measureVoices(*result.program, 16, block_size, true, iterations / 10 + 1);
+			printf("  %6zu %10.2f %10.2f %7.1fx  %s\n", block_size, per_voice, batched, per_voice / batched, formula.c_str());
+		}
+	}
+
+	printf("\nnarrow lanes, 512 samples (us per evaluation of the first output)\n");
+	printf("  %10s %10s %10s  %s\n", "uint8", "uint16", "int32", "formula");
+	for (const string& formula : formulas) {
+		ParseResult result = pratt.parse(formula);
+		if (!result.success || result.program->sequential || !result.program->expr->isModular())
+			continue;
+		Program& program = *result.program;
+		const Expression& output = *program.expr;
+		unordered_map<string, EvaluationResult> vars = makeVars(program, 512);
+		program.evaluate(vars, 512);			// 写入 let 绑定的槽位
+
+		double narrow8 = measureEvaluation([&]() { output.evaluate8(vars, 512); }, iterations / 10 + 1);
+		double narrow16 = measureEvaluation([&]() { output.evaluate16(vars, 512); }, iterations / 10 + 1);
+		NarrowResult8 result8 = output.evaluate8(vars, 512);
+		NarrowResult16 result16 = output.evaluate16(vars, 512);
+
+		program.setLanesEnabled(false);			// 所有节点都在 int32 中求值
+		double wide = measureEvaluation([&]() { output.evaluate(vars, 512); }, iterations / 10 + 1);
+		EvaluationResult wide_result = output.evaluate(vars, 512);
+		program.setLanesEnabled(true);
+
+		if (result8 != NarrowResult8(xt::cast<uint8_t>(wide_result)) || result16 != NarrowResult16(xt::cast<uint16_t>(wide_result))) {
+			printf("  MISMATCH: %s\n", formula.c_str());
+			mismatches++;
+			continue;
+		}
+		printf("  %10.2f %10.2f %10.2f  %s\n", narrow8, narrow16, wide, formula.c_str());
+	}
+
+	return mismatches == 0 ? 0 : 1;
+}
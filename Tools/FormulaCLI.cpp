@@ -0,0 +1,182 @@
+// 公式引擎命令行工具
+// 用法:
+//   FormulaCLI verify-lanes [bits] [formula...]    窄 lane 与全 int32 求值逐位对照，省略公式时使用内置的公式集
+//   FormulaCLI verify-folding [seed]               常数化简、int32 求值与窄 lane 求值在边界值上逐位对照
+//   FormulaCLI verify-transport [seed]             由宿主 PPQ 换算的 T 在 block 之间连续 (各种过采样倍数与循环区间)
+//   FormulaCLI verify-normalize [seed]             规范文本与原文的解析结果相同 (公式缓存与序列化的哈希依赖于此)
+//   FormulaCLI profile [blocks] formula            逐节点 profile，输出标注了耗时占比的源码
+//   FormulaCLI calibrate [formula...]              在本机校准开销模型，输出各运算符的开销与公式的估计 / 实测开销
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FormulaCost.h"
+#include "FormulaParser.h"
+#include "FormulaProfiler.h"
+#include "FormulaVerify.h"
+
+using namespace fparse;
+using namespace std;
+
+static const vector<string> default_formulas = {
+	"t*(t>>12|t>>8)&63",
+	"t*(42&t>>10)",
+	"(t*5&t>>7)|(t*3&t>>10)",
+	"(t & 15) * (t >> 4 & 15) + w - x",
+	"((t & 255) * 3 + (t >> 8 & 255) * 5) ^ (y << 2)",
+	"(t & 127) - (t >> 7 & 127) << 3",
+	"sin(t) + tri(T >> 2) ^ (w * x) & 255",
+	"t * ((t >> 9 | t >> 13) & 25 & t >> 6)",
+	"let a = t >> 10 & 63; let b = (a & 42) * (t & 7); b ^ (b >> 8) | sin(a + T)",
+	"abs((t & 1023) - 512) * 3 + (z & 3) * 100",
+	"((t % 1000) * 7 | (t / 3 & 31)) - rand()",
+	"srand(t >> 4) & (t * 3 + 1)",
+};
+
+static int usage() {
+	printf("usage: FormulaCLI verify-lanes [bits] [formula...]\n");
+	printf("       FormulaCLI verify-folding [seed]\n");
+	printf("       FormulaCLI verify-transport [seed]\n");
+	printf("       FormulaCLI verify-normalize [seed]\n");
+	printf("       FormulaCLI profile [blocks] formula\n");
+	printf("       FormulaCLI calibrate [formula...]\n");
+	return 2;
+}
+
+static int verifyLanesCommand(int argc, char* argv[]) {
+	int bits = 8;
+	int first = 0;
+	if (argc > 0 && string(argv[0]).find_first_not_of("0123456789") == string::npos) {
+		bits = atoi(argv[0]);
+		first = 1;
+	}
+
+	vector<string> formulas(argv + first, argv + argc);
+	if (formulas.empty())
+		formulas = default_formulas;
+
+	FormulaParser parser;
+	int failures = 0;
+	for (const string& formula : formulas) {
+		VerifyReport report = verifyLanes(parser, formula, bits);
+		printf("  %-4s %8zu samples  %s\n", report.success ? "ok" : "FAIL", report.samples, formula.c_str());
+		if (!report.success) {
+			printf("       %s (%zu mismatches)\n", report.msg.c_str(), report.mismatches);
+			failures++;
+		}
+	}
+
+	printf("%d of %zu formulas failed (%d-bit output)\n", failures, formulas.size(), bits);
+	return failures == 0 ? 0 : 1;
+}
+
+static int verifyFoldingCommand(int argc, char* argv[]) {
+	uint32_t seed = argc > 0 ? uint32_t(strtoul(argv[0], nullptr, 10)) : 1;
+
+	VerifyReport report = verifyFolding(64, seed);
+	printf("  %-4s %8zu comparisons\n", report.success ? "ok" : "FAIL", report.samples);
+	if (!report.success)
+		printf("       %s (%zu mismatches)\n", report.msg.c_str(), report.mismatches);
+	return report.success ? 0 : 1;
+}
+
+static int verifyTransportCommand(int argc, char* argv[]) {
+	uint32_t seed = argc > 0 ? uint32_t(strtoul(argv[0], nullptr, 10)) : 1;
+
+	VerifyReport report = verifyTransport(200, seed);
+	printf("  %-4s %8zu samples\n", report.success ? "ok" : "FAIL", report.samples);
+	if (!report.success)
+		printf("       %s (%zu mismatches)\n", report.msg.c_str(), report.mismatches);
+	return report.success ? 0 : 1;
+}
+
+static int verifyNormalizeCommand(int argc, char* argv[]) {
+	uint32_t seed = argc > 0 ? uint32_t(strtoul(argv[0], nullptr, 10)) : 1;
+
+	VerifyReport report = verifyNormalization(32, seed);
+	printf("  %-4s %8zu formulas\n", report.success ? "ok" : "FAIL", report.samples);
+	if (!report.success)
+		printf("       %s (%zu mismatches)\n", report.msg.c_str(), report.mismatches);
+	return report.success ? 0 : 1;
+}
+
+static int profileCommand(int argc, char* argv[]) {
+	size_t blocks = 200;
+	int first = 0;
+	if (argc > 1) {
+		blocks = static_cast<size_t>(atoi(argv[0]));
+		first = 1;
+	}
+	if (argc <= first)
+		return usage();
+
+	string formula = argv[first];
+	FormulaParser parser;
+	ParseResult result = parser.parse(formula);
+	if (!result.success) {
+		printf("Line %zu, column %zu: %s\n", result.line, result.col, result.msg.c_str());
+		return 1;
+	}
+
+	EvaluationProfile profile = profileProgram(*result.program, 512, blocks);
+	printf("%s", profileReport(formula, profile).c_str());
+	return 0;
+}
+
+static int calibrateCommand(int argc, char* argv[]) {
+	static const char* operation_names[] = { "", "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>" };
+
+	const OperatorCosts& defaults = OperatorCosts::defaults();
+	OperatorCosts costs = calibrateOperatorCosts();
+
+	printf("%-10s %10s %10s  (ns per sample)\n", "node", "measured", "default");
+	for (int op = 1; op <= 10; op++)
+		printf("%-10s %10.3f %10.3f\n", operation_names[op], costs.operation_ns[op], defaults.operation_ns[op]);
+	for (const auto& [name, cost] : costs.function_ns)
+		printf("%-10s %10.3f %10.3f\n", (name + "()").c_str(), cost, defaults.function_ns.at(name));
+	printf("%-10s %10.3f %10.3f\n", "leaf", costs.leaf_ns, defaults.leaf_ns);
+	printf("%-10s %10.3f %10.3f  (ns per node evaluation)\n", "call", costs.call_ns, defaults.call_ns);
+	printf("%-10s %10.3f %10.3f  (ns per node per sample, stateful formulas)\n", "scalar", costs.scalar_ns, defaults.scalar_ns);
+	printf("%-10s %10.3f %10.3f  (relative to int32)\n", "uint8", costs.lane8_factor, defaults.lane8_factor);
+	printf("%-10s %10.3f %10.3f\n", "uint16", costs.lane16_factor, defaults.lane16_factor);
+
+	// 估计值与 profile 实测值的对照
+	vector<string> formulas(argv, argv + argc);
+	if (formulas.empty())
+		formulas = default_formulas;
+
+	OperatorCosts::setCurrent(make_shared<const OperatorCosts>(costs));
+	FormulaParser parser;
+	printf("\n%10s %10s  formula (ns per sample, 512-sample blocks)\n", "estimated", "measured");
+	for (const string& formula : formulas) {
+		ParseResult result = parser.parse(formula);
+		if (!result.success)
+			continue;
+		EvaluationProfile profile = profileProgram(*result.program, 512, 200);
+		printf("%10.2f %10.2f  %s\n", result.cost, profile.total_ns / (512. * 200.), formula.c_str());
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2)
+		return usage();
+
+	string command = argv[1];
+	if (command == "verify-lanes")
+		return verifyLanesCommand(argc - 2, argv + 2);
+	if (command == "verify-folding")
+		return verifyFoldingCommand(argc - 2, argv + 2);
+	if (command == "verify-transport")
+		return verifyTransportCommand(argc - 2, argv + 2);
+	if (command == "verify-normalize")
+		return verifyNormalizeCommand(argc - 2, argv + 2);
+	if (command == "profile")
+		return profileCommand(argc - 2, argv + 2);
+	if (command == "calibrate")
+		return calibrateCommand(argc - 2, argv + 2);
+	return usage();
+}
@@ -0,0 +1,111 @@
+// 公式引擎的差分 fuzz: 引擎的各条求值路径与标量参考实现 (FormulaReference.h) 逐 sample 对照
+// 用法:
+//   FormulaFuzz [iterations] [seed]    随机生成公式并对照，遇到不一致时输出公式并返回 1
+// 定义 BITALCHEMY_LIBFUZZER 时编译为 libFuzzer 的目标 (不含 main):
+//   第一个字节为偶数时，其余字节作为随机公式生成器的种子
+//   第一个字节为奇数时，其余字节作为公式源码: PRATT 与 PEG 的解析结果须一致，再以未化简的解析结果作为参考对照
+//   不一致时 abort()
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "FormulaParser.h"
+#include "FormulaReference.h"
+#include "FormulaVerify.h"
+
+using namespace fparse;
+using namespace std;
+
+static const FormulaParser& prattParser() {
+	static const FormulaParser parser(FormulaParser::Backend::PRATT);
+	return parser;
+}
+
+static const FormulaParser& pegParser() {
+	static const FormulaParser parser(FormulaParser::Backend::PEG);
+	return parser;
+}
+
+// 不化简常数与恒等式，与随机生成的 Program 一样作为参考; 以化简后的树作参考时化简本身的错误无法被发现
+static const FormulaParser& referenceParser() {
+	static const FormulaParser parser(FormulaParser::Backend::PRATT, false);
+	return parser;
+}
+
+// 以 reference 为参考对照 source 的求值结果
+static bool check(const Program& reference, const string& source, uint32_t seed) {
+	VerifyReport report = verifyReference(reference, source, prattParser(), pegParser(), 256, 8, seed);
+	if (report.success)
+		return true;
+
+	printf("MISMATCH\n%s\n  %s\n", source.c_str(), report.msg.c_str());
+	return false;
+}
+
+#ifdef BITALCHEMY_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (size < 1)
+		return 0;
+
+	if (data[0] % 2 == 0) {
+		seed_seq seq(data + 1, data + size);
+		mt19937 rng(seq);
+		shared_ptr<Program> reference = randomProgram(rng);
+		if (!check(*reference, programSource(*reference), uint32_t(size)))
+			abort();
+		return 0;
+	}
+
+	string source(reinterpret_cast<const char*>(data + 1), min<size_t>(size - 1, 256));
+	ParseResult pratt = prattParser().parse(source);
+	ParseResult peg = pegParser().parse(source);
+	if (pratt.success != peg.success) {
+		printf("PRATT and PEG disagree on\n%s\n  PRATT: %s\n  PEG: %s\n", source.c_str(), pratt.msg.c_str(), peg.msg.c_str());
+		abort();
+	}
+	if (!pratt.success)
+		return 0;
+	if (pratt.program->toString() != peg.program->toString()) {
+		printf("PRATT and PEG trees differ for\n%s\n  PRATT: %s\n  PEG: %s\n", source.c_str(), pratt.program->toString().c_str(), peg.program->toString().c_str());
+		abort();
+	}
+	ParseResult reference = referenceParser().parse(source);
+	if (!reference.success) {
+		printf("Unsimplified parse failed for\n%s\n  %s\n", source.c_str(), reference.msg.c_str());
+		abort();
+	}
+	if (!check(*reference.program, source, uint32_t(size)))
+		abort();
+	return 0;
+}
+
+#else
+
+int main(int argc, char* argv[]) {
+	long iterations = argc > 1 ? atol(argv[1]) : 1000;
+	uint32_t seed = argc > 2 ? uint32_t(strtoul(argv[2], nullptr, 10)) : 1;
+
+	mt19937 rng(seed);
+	long failures = 0, skipped = 0;
+	for (long i = 0; i < iterations; i++) {
+		shared_ptr<Program> reference = randomProgram(rng);
+		string source = programSource(*reference);
+		VerifyReport report = verifyReference(*reference, source, prattParser(), pegParser(), 256, 8, rng());
+		if (report.skipped)
+			skipped++;
+		if (!report.success) {
+			printf("MISMATCH (iteration %ld)\n%s\n  %s\n", i, source.c_str(), report.msg.c_str());
+			failures++;
+		}
+	}
+
+	printf("%ld formulas, %ld mismatches, %ld stopped at rand()\n", iterations, failures, skipped);
+	return failures == 0 ? 0 : 1;
+}
+
+#endif